@@ -0,0 +1,369 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "action_cache.h"
+
+#include "remote_action_cache.h"
+
+#include <primitives/exceptions.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__APPLE__)
+#include <sys/clonefile.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "action_cache");
+
+#define ACTION_CACHE_VERSION 1
+
+namespace sw
+{
+
+// copy on write clone when file system supports it, plain copy otherwise
+//
+// Hard links are not used, tools may overwrite their outputs in place
+// and that would change cached blobs.
+static void clone_file(const path &from, const path &to)
+{
+#if defined(__APPLE__)
+    error_code ec;
+    fs::remove(to, ec);
+    if (clonefile(from.c_str(), to.c_str(), 0) == 0)
+        return;
+#elif defined(FICLONE)
+    auto in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in != -1)
+    {
+        auto out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        auto ok = out != -1 && ioctl(out, FICLONE, in) == 0;
+        if (out != -1)
+            close(out);
+        close(in);
+        if (ok)
+        {
+            fs::permissions(to, fs::status(from).permissions());
+            return;
+        }
+    }
+#endif
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing);
+}
+
+// concurrent builds may write the same file
+static void clone_file_atomically(const path &from, const path &to)
+{
+    fs::create_directories(to.parent_path());
+    auto tmp = to.parent_path() / unique_path();
+    tmp += ".tmp";
+    try
+    {
+        clone_file(from, tmp);
+        fs::rename(tmp, to);
+    }
+    catch (...)
+    {
+        error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+}
+
+static void touch(const path &p)
+{
+    error_code ec;
+    fs::last_write_time(p, fs::file_time_type::clock::now(), ec);
+}
+
+static void write_files(String &s, const std::vector<ActionCache::CachedFile> &files)
+{
+    uint32_t n = files.size();
+    s.append((const char *)&n, sizeof(n));
+    for (auto &f : files)
+    {
+        uint32_t sz = f.path.size();
+        s.append((const char *)&sz, sizeof(sz));
+        s += f.path;
+        s.append((const char *)&f.hash, sizeof(f.hash));
+    }
+}
+
+static bool read_files(const String &s, size_t &i, std::vector<ActionCache::CachedFile> &files)
+{
+    auto read = [&s, &i](void *p, size_t sz)
+    {
+        if (i + sz > s.size())
+            return false;
+        memcpy(p, s.data() + i, sz);
+        i += sz;
+        return true;
+    };
+
+    uint32_t n;
+    if (!read(&n, sizeof(n)))
+        return false;
+    for (uint32_t k = 0; k < n; k++)
+    {
+        ActionCache::CachedFile f;
+        uint32_t sz;
+        if (!read(&sz, sizeof(sz)) || i + sz > s.size())
+            return false;
+        f.path.assign(s.data() + i, sz);
+        i += sz;
+        if (!read(&f.hash, sizeof(f.hash)))
+            return false;
+        files.push_back(std::move(f));
+    }
+    return true;
+}
+
+ActionCache::ActionCache(const path &root, uint64_t max_size)
+    : root(root), max_size(max_size)
+{
+}
+
+ActionCache::~ActionCache()
+{
+}
+
+void ActionCache::setRemote(const String &address)
+{
+    remote = std::make_unique<RemoteActionCache>(address);
+    remote_failed = false;
+}
+
+path ActionCache::getActionFilename(const Hash128 &h) const
+{
+    auto s = h.toString();
+    return root / std::to_string(ACTION_CACHE_VERSION) / "ac" / s.substr(0, 2) / s;
+}
+
+path ActionCache::getBlobFilename(const Hash128 &h) const
+{
+    auto s = h.toString();
+    return root / std::to_string(ACTION_CACHE_VERSION) / "cas" / s.substr(0, 2) / s;
+}
+
+path ActionCache::getTemporaryFilename() const
+{
+    auto p = root / std::to_string(ACTION_CACHE_VERSION) / "tmp";
+    fs::create_directories(p);
+    p /= unique_path();
+    p += ".tmp";
+    return p;
+}
+
+bool ActionCache::hasBlob(const Hash128 &h) const
+{
+    return fs::exists(getBlobFilename(h));
+}
+
+void ActionCache::addBlob(const Hash128 &h, const path &tmp)
+{
+    if (hash128(read_file(tmp)) != h)
+    {
+        error_code ec;
+        fs::remove(tmp, ec);
+        throw SW_RUNTIME_ERROR("Action cache: blob content does not match its hash " + h.toString());
+    }
+    auto fn = getBlobFilename(h);
+    fs::create_directories(fn.parent_path());
+    fs::rename(tmp, fn);
+}
+
+std::optional<ActionCache::Action> ActionCache::find(const Hash128 &key)
+{
+    if (auto a = findLocal(key))
+        return a;
+    if (!remote || remote_failed)
+        return {};
+
+    try
+    {
+        auto a = remote->getActionResult(key);
+        if (!a)
+            return {};
+        for (auto &o : a->outputs)
+        {
+            if (hasBlob(o.hash))
+                continue;
+            auto tmp = getTemporaryFilename();
+            remote->readBlob(o.hash, tmp);
+            addBlob(o.hash, tmp);
+        }
+        storeAction(key, *a);
+        remote_hits++;
+        return a;
+    }
+    catch (std::exception &e)
+    {
+        if (!remote_failed.exchange(true))
+            LOG_WARN(logger, "Remote action cache is disabled for this build: " << e.what());
+        return {};
+    }
+}
+
+std::optional<ActionCache::Action> ActionCache::findLocal(const Hash128 &key) const
+{
+    auto fn = getActionFilename(key);
+    if (!fs::exists(fn))
+        return {};
+
+    String s;
+    try
+    {
+        s = read_file(fn);
+    }
+    catch (std::exception &)
+    {
+        return {}; // removed by trim()
+    }
+
+    size_t i = 0;
+    Action a;
+    if (!read_files(s, i, a.implicit_inputs) || !read_files(s, i, a.outputs) || i != s.size())
+    {
+        LOG_WARN(logger, "Action cache entry is corrupted, it will be removed: " << normalize_path(fn));
+        error_code ec;
+        fs::remove(fn, ec);
+        return {};
+    }
+    touch(fn);
+    return a;
+}
+
+void ActionCache::store(const Hash128 &key, const Action &a)
+{
+    // blobs go first, action refers to them
+    for (auto &o : a.outputs)
+        storeBlob(o.hash, fs::u8path(o.path));
+    storeAction(key, a);
+    stores++;
+
+    if (remote && !remote_failed)
+        storeRemote(key, a);
+}
+
+void ActionCache::storeRemote(const Hash128 &key, const Action &a)
+{
+    try
+    {
+        std::vector<Hash128> hashes;
+        for (auto &o : a.outputs)
+            hashes.push_back(o.hash);
+        for (auto &h : remote->findMissingBlobs(hashes))
+            remote->writeBlob(h, getBlobFilename(h));
+        remote->updateActionResult(key, a);
+    }
+    catch (std::exception &e)
+    {
+        if (!remote_failed.exchange(true))
+            LOG_WARN(logger, "Remote action cache is disabled for this build: " << e.what());
+    }
+}
+
+void ActionCache::storeAction(const Hash128 &key, const Action &a)
+{
+    String s;
+    write_files(s, a.implicit_inputs);
+    write_files(s, a.outputs);
+    auto fn = getActionFilename(key);
+    fs::create_directories(fn.parent_path());
+    auto tmp = getTemporaryFilename();
+    write_file(tmp, s);
+    fs::rename(tmp, fn);
+}
+
+bool ActionCache::restore(const Action &a) const
+{
+    for (auto &o : a.outputs)
+    {
+        if (!restoreBlob(o.hash, fs::u8path(o.path)))
+            return false;
+    }
+    return true;
+}
+
+void ActionCache::storeBlob(const Hash128 &h, const path &from)
+{
+    auto b = getBlobFilename(h);
+    if (fs::exists(b))
+        touch(b);
+    else
+        clone_file_atomically(from, b);
+}
+
+bool ActionCache::restoreBlob(const Hash128 &h, const path &to) const
+{
+    auto b = getBlobFilename(h);
+    if (!fs::exists(b))
+        return false;
+    clone_file_atomically(b, to);
+    touch(b);
+    return true;
+}
+
+void ActionCache::trim()
+{
+    struct Entry
+    {
+        path p;
+        fs::file_time_type t;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    error_code ec;
+    for (auto &f : fs::recursive_directory_iterator(root, ec))
+    {
+        if (!f.is_regular_file(ec))
+            continue;
+        Entry e{ f.path(), f.last_write_time(ec), f.file_size(ec) };
+        if (ec)
+            continue;
+        total += e.size;
+        entries.push_back(std::move(e));
+    }
+    if (total <= max_size)
+        return;
+
+    // remove a bit more, so trim is not needed after every build
+    auto target = max_size / 10 * 9;
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.t < b.t; });
+    size_t n = 0;
+    for (auto &e : entries)
+    {
+        if (total <= target)
+            break;
+        if (fs::remove(e.p, ec))
+            total -= e.size, n++;
+    }
+    LOG_DEBUG(logger, "Action cache: removed " << n << " files");
+}
+
+}
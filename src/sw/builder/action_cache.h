@@ -0,0 +1,100 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sw/support/hash.h>
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <memory>
+#include <optional>
+
+namespace sw
+{
+
+struct RemoteActionCache;
+
+/// local content addressed cache of command results
+///
+/// Actions are keyed by command hash and content of the program and explicit inputs.
+/// An action keeps content of implicit inputs seen during its execution,
+/// it is used only when they are the same now.
+/// Outputs are stored once per content in blobs.
+/// When remote cache is set, it is used on local misses and updated on stores.
+struct SW_BUILDER_API ActionCache
+{
+    struct CachedFile
+    {
+        String path; // normalized
+        Hash128 hash;
+    };
+
+    struct Action
+    {
+        std::vector<CachedFile> implicit_inputs;
+        std::vector<CachedFile> outputs;
+    };
+
+    std::atomic_size_t hits = 0;
+    std::atomic_size_t misses = 0;
+    std::atomic_size_t stores = 0;
+    std::atomic_size_t remote_hits = 0;
+
+    ActionCache(const path &root, uint64_t max_size);
+    ~ActionCache();
+
+    /// address of ActionCacheService, host:port
+    void setRemote(const String &address);
+
+    std::optional<Action> find(const Hash128 &key);
+    /// copies outputs into blobs
+    void store(const Hash128 &key, const Action &);
+    /// returns false when some blob is missing
+    bool restore(const Action &) const;
+    /// removes least recently used files until cache fits into its size
+    void trim();
+
+    // local storage only, used by the server too
+    std::optional<Action> findLocal(const Hash128 &key) const;
+    /// blobs must be added first
+    void storeAction(const Hash128 &key, const Action &);
+    bool hasBlob(const Hash128 &) const;
+    path getBlobFilename(const Hash128 &) const;
+    /// checks hash of the file and moves it into blobs
+    void addBlob(const Hash128 &, const path &tmp);
+    /// copies file into blobs, hash is not checked
+    void storeBlob(const Hash128 &, const path &from);
+    /// returns false when blob is missing
+    bool restoreBlob(const Hash128 &, const path &to) const;
+    /// on the same file system as blobs
+    path getTemporaryFilename() const;
+
+private:
+    path root;
+    uint64_t max_size;
+    std::unique_ptr<RemoteActionCache> remote;
+    // remote is not used after the first error, so build does not wait for timeouts
+    std::atomic_bool remote_failed = false;
+
+    path getActionFilename(const Hash128 &) const;
+    void storeRemote(const Hash128 &key, const Action &);
+};
+
+}
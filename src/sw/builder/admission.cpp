@@ -0,0 +1,130 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "admission.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace sw
+{
+
+uint64_t getPhysicalMemorySize()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX s;
+    s.dwLength = sizeof(s);
+    if (!GlobalMemoryStatusEx(&s))
+        return 0;
+    return s.ullTotalPhys;
+#else
+    auto pages = sysconf(_SC_PHYS_PAGES);
+    auto page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages < 0 || page_size < 0)
+        return 0;
+    return (uint64_t)pages * page_size;
+#endif
+}
+
+AdmissionControl::AdmissionControl(const ResourceBudget &b)
+    : budget(b)
+{
+}
+
+bool AdmissionControl::fits(const CommandResources &r) const
+{
+    if (running == 0)
+        return true;
+    if (budget.cpu && cpu + r.cpu > budget.cpu)
+        return false;
+    if (budget.memory && memory + r.memory > budget.memory)
+        return false;
+    if (budget.io && io + r.io > budget.io)
+        return false;
+    if (!r.resource_class.empty())
+    {
+        auto i = budget.class_limits.find(r.resource_class);
+        if (i != budget.class_limits.end())
+        {
+            auto j = classes.find(r.resource_class);
+            if (j != classes.end() && j->second >= i->second)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool AdmissionControl::acquireOrPark(const CommandResources &r, size_t rank, const Retry &retry, bool &remote)
+{
+    std::unique_lock lk(m);
+    remote = false;
+    if (!fits(r))
+    {
+        if (fitsRemote(r))
+        {
+            remote = true;
+            this->remote++;
+            return true;
+        }
+        parked.push_back({ rank, &r, &retry });
+        return false;
+    }
+    running++;
+    cpu += r.cpu;
+    memory += r.memory;
+    io += r.io;
+    if (!r.resource_class.empty())
+        classes[r.resource_class]++;
+    return true;
+}
+
+void AdmissionControl::release(const CommandResources &r, bool remote, bool flush)
+{
+    std::vector<Parked> retried;
+    std::unique_lock lk(m);
+    if (remote)
+        this->remote--;
+    else
+    {
+        running--;
+        cpu -= r.cpu;
+        memory -= r.memory;
+        io -= r.io;
+        if (!r.resource_class.empty())
+            classes[r.resource_class]--;
+    }
+
+    // we do not reserve resources here, retried commands may be parked again,
+    // but then some other command is running and will wake them later
+    auto i = std::partition(parked.begin(), parked.end(), [this, flush](auto &p)
+    {
+        return !flush && !fits(*p.resources) && !fitsRemote(*p.resources);
+    });
+    retried.assign(i, parked.end());
+    parked.erase(i, parked.end());
+    lk.unlock();
+
+    // parked commands keep their plans running, so retry functions are alive here
+    for (auto &p : retried)
+        (*p.retry)(p.rank);
+}
+
+}
@@ -0,0 +1,89 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "command.h"
+
+#include <functional>
+#include <mutex>
+
+namespace sw
+{
+
+/// machine resources available for running commands, 0 = unlimited
+struct SW_BUILDER_API ResourceBudget
+{
+    int cpu = 0;
+    uint64_t memory = 0;
+    int io = 0;
+    // slots of remote workers, they take remote commands when local cpus are busy
+    int remote = 0;
+    // max number of simultaneously running commands of the class
+    std::unordered_map<String, int> class_limits;
+
+    bool empty() const { return !cpu && !memory && !io && !remote && class_limits.empty(); }
+};
+
+SW_BUILDER_API
+uint64_t getPhysicalMemorySize();
+
+/// decides when a ready command may start
+///
+/// Commands that do not fit the budget are parked under their ranks
+/// and retried when running commands release their resources.
+/// A command is always admitted when nothing else is running,
+/// so oversized commands do not block the build.
+/// Remote commands go to remote slots only when they do not fit locally.
+/// One object may be shared by plans running on the same executor.
+struct SW_BUILDER_API AdmissionControl
+{
+    /// called with rank of parked command that may fit now
+    using Retry = std::function<void(size_t)>;
+
+    AdmissionControl(const ResourceBudget &);
+
+    /// returns false if command was parked, 'retry' must live until it is called,
+    /// 'remote' is set when command was admitted to remote slot
+    bool acquireOrPark(const CommandResources &, size_t rank, const Retry &, bool &remote);
+    /// retries parked commands, all of them when 'flush' is set
+    void release(const CommandResources &, bool remote, bool flush = false);
+
+private:
+    struct Parked
+    {
+        size_t rank;
+        const CommandResources *resources;
+        const Retry *retry;
+    };
+
+    ResourceBudget budget;
+    std::mutex m;
+    size_t running = 0;
+    int cpu = 0;
+    uint64_t memory = 0;
+    int io = 0;
+    int remote = 0;
+    std::unordered_map<String, int> classes;
+    std::vector<Parked> parked;
+
+    bool fits(const CommandResources &) const;
+    bool fitsRemote(const CommandResources &r) const { return r.remote && remote < budget.remote; }
+};
+
+}
@@ -21,12 +21,14 @@
 #define BOOST_THREAD_VERSION 5
 #include "command.h"
 
+#include "action_cache.h"
 #include "command_storage.h"
 #include "file.h"
 #include "file_storage.h"
 #include "jumppad.h"
 #include "os.h"
 #include "program.h"
+#include "remote_executor.h"
 #include "sw_context.h"
 
 #include <sw/manager/settings.h>
@@ -103,12 +105,19 @@ static String getCommandId(const Command &c)
     return s;
 }
 
-bool Command::check_if_file_newer(const path &p, const String &what, bool throw_on_missing) const
+bool Command::check_if_file_newer(File f, const String &what, bool throw_on_missing) const
 {
-    auto s = File(p, getContext().getFileStorage()).isChanged(mtime, throw_on_missing);
+    auto s = f.isChanged(mtime, throw_on_missing);
+    auto &fd = f.getFileData();
+    if (s && fd.same_content_since <= mtime && fd.last_write_time != fs::file_time_type::min())
+    {
+        // early cutoff, generator rewrote the file with the same content
+        cutoff_mtime = std::max(cutoff_mtime, fd.last_write_time);
+        return false;
+    }
     if (s && isExplainNeeded())
     {
-        EXPLAIN_OUTDATED("command", true, what + " changed " + normalize_path(p) + " (command_storage = " +
+        EXPLAIN_OUTDATED("command", true, what + " changed " + normalize_path(f.file) + " (command_storage = " +
             normalize_path(command_storage->root) + ") : " + *s, getCommandId(*this));
     }
     return !!s;
@@ -143,8 +152,36 @@ bool Command::isOutdated() const
     else
     {
         ((Command*)(this))->mtime = r.first->mtime;
-        ((Command*)(this))->implicit_inputs = r.first->getImplicitInputs(command_storage->getInternalStorage());
-        return isTimeChanged();
+        ((Command*)(this))->implicit_inputs = r.first->implicit_inputs;
+        if (getContext().content_hash_check && r.first->inputs_hash)
+            return isContentChanged(*r.first);
+        if (isTimeChanged())
+            return true;
+        if (cutoff_mtime > mtime)
+        {
+            // remember new time, so the inputs are not newer on the next run
+            ((Command*)(this))->mtime = cutoff_mtime;
+            r.first->mtime = cutoff_mtime;
+            command_storage->async_command_log(*r.first);
+        }
+        return false;
+    }
+}
+
+void Command::refreshFiles() const
+{
+    auto &fs = getContext().getFileStorage();
+    for (auto &i : inputs)
+        File(i, fs).isChanged();
+    for (auto &i : outputs)
+        File(i, fs).isChanged();
+
+    if (always || !command_storage)
+        return;
+    if (auto r = command_storage->find(getHash()))
+    {
+        for (auto i : r->implicit_inputs)
+            File(i, fs).isChanged();
     }
 }
 
@@ -153,13 +190,13 @@ bool Command::isTimeChanged() const
     try
     {
         return std::any_of(inputs.begin(), inputs.end(), [this](const auto &i) {
-                   return check_if_file_newer(i, "input", true);
+                   return check_if_file_newer(File(i, getContext().getFileStorage()), "input", true);
                }) ||
                std::any_of(outputs.begin(), outputs.end(), [this](const auto &i) {
-                   return check_if_file_newer(i, "output", false);
+                   return check_if_file_newer(File(i, getContext().getFileStorage()), "output", false);
                }) ||
                std::any_of(implicit_inputs.begin(), implicit_inputs.end(), [this](const auto &i) {
-                   return check_if_file_newer(i, "implicit input", true);
+                   return check_if_file_newer(File(i, getContext().getFileStorage()), "implicit input", true);
                });
     }
     catch (std::exception &e)
@@ -170,6 +207,173 @@ bool Command::isTimeChanged() const
     }
 }
 
+// inputs may be touched without changes (branch switch, restored caches),
+// so when they are newer than command, their content is compared
+bool Command::isContentChanged(CommandRecord &r) const
+{
+    try
+    {
+        if (std::any_of(outputs.begin(), outputs.end(), [this](const auto &i) {
+                return check_if_file_newer(File(i, getContext().getFileStorage()), "output", false);
+            }))
+            return true;
+
+        std::vector<File> files;
+        files.reserve(inputs.size() + implicit_inputs.size());
+        for (auto &i : inputs)
+            files.emplace_back(i, getContext().getFileStorage());
+        for (auto i : implicit_inputs)
+            files.emplace_back(i, getContext().getFileStorage());
+
+        auto t = mtime;
+        for (auto &f : files)
+        {
+            f.isChanged();
+            auto lwt = f.getFileData().last_write_time;
+            if (lwt == fs::file_time_type::min())
+                return check_if_file_newer(f, "input", true); // missing
+            t = std::max(t, lwt);
+        }
+        if (t == mtime)
+            return false;
+
+        if (getInputsHash() != r.inputs_hash)
+        {
+            if (isExplainNeeded())
+                EXPLAIN_OUTDATED("command", true, "content of inputs changed (command_storage = " +
+                    normalize_path(command_storage->root) + ")", getCommandId(*this));
+            return true;
+        }
+
+        // remember new time, so inputs are not hashed again on the next run
+        ((Command*)(this))->mtime = t;
+        r.mtime = t;
+        command_storage->async_command_log(r);
+        return false;
+    }
+    catch (std::exception &e)
+    {
+        String s = "Command: " + getName() + "\n";
+        s += e.what();
+        throw SW_RUNTIME_ERROR(s);
+    }
+}
+
+Hash128 Command::getFilesHash(const std::vector<FileId> &files) const
+{
+    std::vector<std::pair<uint64_t, Hash128>> hashes;
+    hashes.reserve(files.size());
+    for (auto id : files)
+    {
+        File f(id, getContext().getFileStorage());
+        hashes.emplace_back(getPathInterner().getHash(id), command_storage->getContentHash(f));
+    }
+
+    // file ids are different in every process, path hashes are not
+    std::sort(hashes.begin(), hashes.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    hashes.erase(std::unique(hashes.begin(), hashes.end(), [](const auto &a, const auto &b) { return a.first == b.first; }), hashes.end());
+    Hasher h;
+    for (auto &[p, c] : hashes)
+    {
+        h.add(p);
+        h.add(c);
+    }
+    return h.digest();
+}
+
+static std::vector<FileId> intern(const Files &files)
+{
+    std::vector<FileId> ids;
+    ids.reserve(files.size());
+    for (auto &f : files)
+        ids.push_back(getPathInterner().intern(f));
+    return ids;
+}
+
+Hash128 Command::getOutputsHash() const
+{
+    return getFilesHash(intern(outputs));
+}
+
+Hash128 Command::getInputsHash() const
+{
+    auto files = intern(inputs);
+    files.insert(files.end(), implicit_inputs.begin(), implicit_inputs.end());
+    return getFilesHash(files);
+}
+
+// program content is included, it may be updated in place
+Hash128 Command::getActionKey() const
+{
+    auto files = intern(inputs);
+    files.push_back(getPathInterner().intern(getProgram()));
+    Hasher h;
+    h.add(getHash());
+    h.add(getFilesHash(files));
+    return h.digest();
+}
+
+bool Command::restoreFromActionCache()
+{
+    auto &ac = getContext().action_cache;
+    if (!ac || !cacheable || !command_storage)
+        return false;
+
+    auto miss = [&ac]()
+    {
+        ac->misses++;
+        return false;
+    };
+
+    auto a = ac->find(getActionKey());
+    if (!a)
+        return miss();
+    // implicit inputs of the cached execution must be the same
+    for (auto &i : a->implicit_inputs)
+    {
+        File f(getPathInterner().internNormalized(i.path), getContext().getFileStorage());
+        if (command_storage->getContentHash(f) != i.hash)
+            return miss();
+    }
+    if (!ac->restore(*a))
+        return miss();
+    ac->hits++;
+
+    implicit_inputs.clear();
+    for (auto &i : a->implicit_inputs)
+        implicit_inputs.push_back(getPathInterner().internNormalized(i.path));
+    restored_from_cache = true;
+    return true;
+}
+
+void Command::storeToActionCache(const CommandRecord &r) const
+{
+    auto &ac = getContext().action_cache;
+    if (!ac || !cacheable || restored_from_cache)
+        return;
+
+    ActionCache::Action a;
+    auto add = [this](auto &files, FileId id)
+    {
+        File f(id, getContext().getFileStorage());
+        files.push_back({ getPathInterner().getString(id), command_storage->getContentHash(f) });
+    };
+    for (auto i : r.implicit_inputs)
+        add(a.implicit_inputs, i);
+    for (auto i : intern(outputs))
+        add(a.outputs, i);
+
+    try
+    {
+        ac->store(getActionKey(), a);
+    }
+    catch (std::exception &e)
+    {
+        // cache is not essential
+        LOG_WARN(logger, "Cannot store command into action cache: " << getName() << ": " << e.what());
+    }
+}
+
 size_t Command::getHash() const
 {
     if (hash != 0)
@@ -179,8 +383,9 @@ size_t Command::getHash() const
 
 size_t Command::getHash1() const
 {
-    size_t h = 0;
-    hash_combine(h, std::hash<path>()(getProgram()));
+    // stable hash, keys are stored in command db
+    Hasher h;
+    h.add(getProgram().u8string());
 
     // must sort arguments first
     // because some command may generate args in unspecified order
@@ -191,33 +396,31 @@ size_t Command::getHash1() const
     Strings sa;
     for (auto &a : arguments)
         args_sorted.insert(a->toString());
+    h.add(args_sorted.size());
     for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
+        h.add(a);
     //for (auto &a : arguments)
         //hash_combine(h, std::hash<String>()(a->toString()));
 
     // redirections are also considered as arguments
-    if (!in.file.empty())
-        hash_combine(h, std::hash<path>()(in.file));
-    if (!out.file.empty())
-        hash_combine(h, std::hash<path>()(out.file));
-    if (!err.file.empty())
-        hash_combine(h, std::hash<path>()(err.file));
+    h.add(in.file.u8string());
+    h.add(out.file.u8string());
+    h.add(err.file.u8string());
 
-    hash_combine(h, std::hash<path>()(working_directory));
+    h.add(working_directory.u8string());
 
     // read other env vars? some of them may have influence
     for (auto &[k, v] : environment)
     {
-        hash_combine(h, std::hash<String>()(k));
-        hash_combine(h, std::hash<String>()(v));
+        h.add(k);
+        h.add(v);
     }
 
     // command may depend on files not listed on the command line (dlls)?
     //for (auto &i : inputs)
         //hash_combine(h, std::hash<path>()(i));
 
-    return h;
+    return h.digest().get64();
 }
 
 size_t Command::getHashAndSave() const
@@ -251,7 +454,7 @@ void Command::addImplicitInput(const path &p)
 {
     if (p.empty())
         return;
-    implicit_inputs.insert(p);
+    implicit_inputs.push_back(getPathInterner().intern(p));
 }
 
 void Command::addImplicitInput(const Files &files)
@@ -356,6 +559,10 @@ void Command::prepare()
         File(p, getContext().getFileStorage()).setGenerator(std::static_pointer_cast<Command>(shared_from_this()), false);
     }
 
+    // response file name is known only during execution
+    if (!needsResponseFile())
+        spawn_args = makeSpawnArgs(*this);
+
     prepared = true;
 
     if (prev)
@@ -407,7 +614,10 @@ void Command::execute0(std::error_code *ec)
 
     if (!beforeCommand())
         return;
-    execute1(ec); // main thing
+    auto start = Clock::now();
+    if (!restoreFromActionCache())
+        execute1(ec); // main thing
+    execution_time = Clock::now() - start;
     if (ec && *ec)
         return;
     afterCommand();
@@ -460,10 +670,14 @@ void Command::afterCommand()
         mtime = std::max(mtime, fr.last_write_time);
     }
 
+    // times before execution, for early cutoff
+    std::vector<std::pair<FileData *, fs::file_time_type>> old_outputs;
+    old_outputs.reserve(outputs.size());
     for (auto &i : outputs)
     {
         File f(i, getContext().getFileStorage());
         auto &fr = f.getFileData();
+        old_outputs.emplace_back(&fr, fr.last_write_time);
         fr.refreshed = FileData::RefreshType::Unrefreshed;
         f.isChanged();
         if (!fs::exists(i))
@@ -480,7 +694,7 @@ void Command::afterCommand()
     // sometimes, implicit input was not created before it is registered with File(fn) - configureFile() etc.
     // in this case here we have fr.last_write_time == min()
     // so, we must register this file again
-    for (auto &i : implicit_inputs)
+    for (auto i : implicit_inputs)
     {
         File f(i, getContext().getFileStorage());
         auto &fr = f.getFileData();
@@ -504,7 +718,36 @@ void Command::afterCommand()
     auto &r = *command_storage->insert(k).first;
     r.hash = k;
     r.mtime = mtime;
-    r.setImplicitInputs(implicit_inputs, command_storage->getInternalStorage());
+    CommandExecutionStats s;
+    auto sat = [](uint64_t v) { return (uint32_t)std::min<uint64_t>(v, UINT32_MAX); };
+    s.wall = sat(std::chrono::duration_cast<std::chrono::microseconds>(execution_time).count());
+    s.user = sat(usage.user);
+    s.sys = sat(usage.sys);
+    s.peak_rss = sat(usage.peak_rss / 1024);
+    // keep real execution stats for scheduling
+    if (!restored_from_cache)
+        r.addExecution(s);
+    r.setImplicitInputs(implicit_inputs);
+    // stale hash must not be kept, inputs may be changed while the check is off
+    r.inputs_hash = getContext().content_hash_check ? getInputsHash() : Hash128{};
+    if (getContext().early_cutoff)
+    {
+        auto h = getOutputsHash();
+        if (h && h == r.outputs_hash)
+        {
+            // outputs are rewritten with the same content,
+            // dependents built after their old times need not run
+            for (auto &[fr, t] : old_outputs)
+            {
+                if (t != fs::file_time_type::min())
+                    fr->same_content_since = t;
+            }
+        }
+        r.outputs_hash = h;
+    }
+    else
+        r.outputs_hash = {};
+    storeToActionCache(r);
     command_storage->async_command_log(r);
 }
 
@@ -600,7 +843,7 @@ void Command::execute1(std::error_code *ec)
 
     if (ec)
     {
-        Base::execute(*ec);
+        executeProcess(*ec);
         if (ec)
         {
             // TODO: save error string
@@ -611,10 +854,12 @@ void Command::execute1(std::error_code *ec)
     else
     {
         std::error_code ec;
-        Base::execute(ec);
+        executeProcess(ec);
         if (ec)
         {
             auto err = make_error_string();
+            if (getErrors().empty())
+                err += "\n" + ec.message();
             throw SW_RUNTIME_ERROR(err);
         }
     }
@@ -628,6 +873,87 @@ void Command::execute1(std::error_code *ec)
     printOutputs();
 }
 
+void Command::executeProcess(std::error_code &ec)
+{
+    // own spawn gives us resource usage of the child
+    usage = {};
+    onBeforeRun();
+    if (run_remotely && executeRemotely(ec))
+    {
+        onEnd();
+        return;
+    }
+    if (executeAndMeasure(*this, ec, usage, &spawn_args))
+    {
+        onEnd();
+        return;
+    }
+    Base::execute(ec);
+}
+
+// returns false when command must be run locally
+bool Command::executeRemotely(std::error_code &ec)
+{
+    auto &re = getContext().remote_executor;
+    if (!re || !command_storage)
+        return false;
+    // only captured output is sent back
+    if (!in.file.empty() || !out.file.empty() || !err.file.empty() || out.inherit || err.inherit)
+        return false;
+    auto cr = command_storage->find(getHash());
+    if (!cr)
+        return false;
+
+    try
+    {
+        RemoteExecutor::Request rq;
+        for (auto &a : getArguments())
+            rq.arguments.push_back(a->toString());
+        for (auto &[k, v] : environment)
+            rq.environment[k] = v;
+        rq.working_directory = working_directory;
+
+        auto &fst = getContext().getFileStorage();
+        auto files = intern(inputs);
+        files.insert(files.end(), cr->implicit_inputs.begin(), cr->implicit_inputs.end());
+        for (auto id : files)
+        {
+            File f(id, fst);
+            // missing files are the worker's problem
+            if (auto h = command_storage->getContentHash(f))
+                rq.inputs.push_back({ getPathInterner().getString(id), h });
+        }
+        // response file is temporary, so it is not in file storage
+        if (!rsp_args.empty())
+        {
+            auto a = rsp_args.back()->toString();
+            if (!a.empty() && a[0] == '@')
+            {
+                auto p = fs::u8path(a.substr(1));
+                rq.inputs.push_back({ normalize_path(p), hash128(read_file(p)) });
+            }
+        }
+        File prog(getProgram(), fst);
+        rq.program_hash = command_storage->getContentHash(prog);
+        for (auto &o : getRemoteOutputs())
+            rq.outputs.push_back(normalize_path(o));
+
+        auto r = re->execute(rq);
+        out.text = r.out;
+        err.text = r.err;
+        exit_code = r.exit_code;
+        if (r.exit_code)
+            ec = make_process_exit_error(r.exit_code);
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        re->failed++;
+        LOG_DEBUG(logger, "Remote execution failed, running locally: " << getName() << ": " << e.what());
+        return false;
+    }
+}
+
 void Command::printOutputs()
 {
     if (!show_output)
@@ -1053,6 +1379,28 @@ bool Command::lessDuringExecution(const CommandNode &in) const
     return dependent_commands.size() > dependent_commands.size();
 }
 
+uint64_t Command::getExecutionCost() const
+{
+    if (!command_storage)
+        return 0;
+    // record is missing for new commands
+    if (auto r = command_storage->find(getHash()))
+        return r->getDuration();
+    return 0;
+}
+
+CommandResources Command::getResources() const
+{
+    auto r = resources;
+    auto cr = command_storage ? command_storage->find(getHash()) : nullptr;
+    if (!r.memory && cr)
+        r.memory = cr->getPeakRss();
+    // implicit inputs must be known from the previous run, they are sent to worker
+    if (r.remote && (!getContext().remote_executor || !cr))
+        r.remote = false;
+    return r;
+}
+
 void Command::onBeforeRun() noexcept
 {
     tid = std::this_thread::get_id();
@@ -1106,10 +1454,10 @@ void CommandSequence::execute1(std::error_code *ec)
 
 size_t CommandSequence::getHash1() const
 {
-    size_t h = 0;
+    Hasher h;
     for (auto &c : commands)
-        hash_combine(h, c->getHash());
-    return h;
+        h.add(c->getHash());
+    return h.digest().get64();
 }
 
 void CommandSequence::prepare()
@@ -1185,7 +1533,7 @@ size_t BuiltinCommand::getHash1() const
     // 3: function name
     // 4: version
 
-    size_t h = 0;
+    Hasher h;
 
     // must sort arguments first
     // because some command may generate args in unspecified order
@@ -1197,9 +1545,9 @@ size_t BuiltinCommand::getHash1() const
         args_sorted.insert((*a)->toString());
 
     for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
+        h.add(a);
 
-    return h;
+    return h.digest().get64();
 }
 
 String getInternalCallBuiltinFunctionName()
@@ -19,6 +19,8 @@
 #pragma once
 
 #include "node.h"
+#include "path_interner.h"
+#include "process.h"
 
 #include <primitives/command.h>
 #include <primitives/executor.h>
@@ -29,19 +31,38 @@
 namespace sw
 {
 
+struct CommandRecord;
+struct File;
+struct Hash128;
 struct Program;
 struct SwBuilderContext;
 struct CommandStorage;
 
+/// resources used by a command during execution
+struct CommandResources
+{
+    int cpu = 1; // cpu slots
+    uint64_t memory = 0; // peak rss estimate in bytes, 0 = unknown
+    int io = 0; // io weight
+    // commands of the same class may be limited together, e.g. "link"
+    String resource_class;
+    // may be executed by remote worker
+    bool remote = false;
+};
+
 struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
 {
     using SPtr = std::shared_ptr<CommandNode>;
 
+    // edges used during plan construction,
+    // execution plan moves them into its compact graph
     std::unordered_set<SPtr> dependencies;
-
-    std::atomic_size_t dependencies_left = 0;
     std::unordered_set<SPtr> dependent_commands;
 
+    // own cost + max cost of the dependent chain
+    // set by execution plan before execution
+    uint64_t critical_path_cost = 0;
+
     std::atomic_size_t *current_command = nullptr;
     std::atomic_size_t *total_commands = nullptr;
 
@@ -56,6 +77,9 @@ struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
     virtual void prepare() = 0; // some internal preparations, command may not be executed still
     //virtual void markForExecution() {} // not command can be sure, it will be executed
     virtual bool lessDuringExecution(const CommandNode &) const = 0;
+    // estimated execution cost (usually from previous runs), 0 = unknown
+    virtual uint64_t getExecutionCost() const { return 0; }
+    virtual CommandResources getResources() const { return {}; }
 
     void clear()
     {
@@ -144,7 +168,8 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     // C I1 O1 I2 O2
     // then split that command!
     Files outputs;
-    Files implicit_inputs;
+    // interned, because there are many of them and they are stored in command db
+    std::vector<FileId> implicit_inputs;
 
     // additional create dirs
     Files output_dirs;
@@ -155,16 +180,21 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     bool remove_outputs_before_execution = false; // was true
     bool protect_args_with_quotes = true;
     bool always = false;
+    bool cacheable = false; // outputs may be restored from action cache
+    bool run_remotely = false; // set by execution plan for commands admitted to remote slots
     bool do_not_save_command = false;
     bool silent = false; // no log record
     bool show_output = false; // no command output
     bool write_output_to_file = false;
     int strict_order = 0; // used to execute this before other commands
     std::shared_ptr<ResourcePool> pool;
+    CommandResources resources;
 
     std::thread::id tid;
     Clock::time_point t_begin;
     Clock::time_point t_end;
+    Clock::duration execution_time{}; // wall time of the last execute1() call
+    ProcessUsage usage; // of the last spawned process, when measured
 
     path command_storage_root; // used during deserialization to restore command_storage
     CommandStorage *command_storage = nullptr;
@@ -184,6 +214,8 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     size_t getHash() const override;
 
     virtual bool isOutdated() const;
+    /// refreshes data of files checked by isOutdated(), so the check does not touch disk
+    void refreshFiles() const;
     bool needsResponseFile() const;
     bool needsResponseFile(size_t sz) const;
 
@@ -204,6 +236,8 @@ struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableComman
     path writeCommand(const path &basename, bool print_name = true) const;
 
     bool lessDuringExecution(const CommandNode &rhs) const override;
+    uint64_t getExecutionCost() const override;
+    CommandResources getResources() const override;
 
     void onBeforeRun() noexcept override;
     void onEnd() noexcept override;
@@ -225,15 +259,22 @@ protected:
     bool prepared = false;
     bool executed_ = false;
 
-    virtual bool check_if_file_newer(const path &, const String &what, bool throw_on_missing) const;
+    virtual bool check_if_file_newer(File, const String &what, bool throw_on_missing) const;
+    /// outputs that are sent back by remote worker, some of them may be missing
+    virtual Files getRemoteOutputs() const { return outputs; }
 
 private:
     const SwBuilderContext *swctx = nullptr;
     mutable size_t hash = 0;
+    // newest time of inputs skipped by early cutoff
+    mutable fs::file_time_type cutoff_mtime = fs::file_time_type::min();
+    bool restored_from_cache = false;
     Arguments rsp_args;
+    SpawnArgs spawn_args; // made during prepare()
     mutable String log_string;
 
     void execute0(std::error_code *ec);
+    void executeProcess(std::error_code &ec);
     virtual void execute1(std::error_code *ec = nullptr);
     virtual size_t getHash1() const;
 
@@ -243,6 +284,14 @@ private:
     bool beforeCommand();
     void afterCommand();
     bool isTimeChanged() const;
+    bool isContentChanged(CommandRecord &) const;
+    Hash128 getInputsHash() const;
+    Hash128 getOutputsHash() const;
+    Hash128 getFilesHash(const std::vector<FileId> &) const;
+    Hash128 getActionKey() const;
+    bool restoreFromActionCache();
+    void storeToActionCache(const CommandRecord &) const;
+    bool executeRemotely(std::error_code &ec);
     void printLog() const;
     size_t getHashAndSave() const;
     String makeErrorString();
@@ -260,11 +309,19 @@ private:
 
         ar & name;
 
+        // storage root follows real pointers only,
+        // on loading it goes to command_storage_root
         size_t flag = (size_t)command_storage;
         ar & flag;
-        if (flag != 1)
-            ar & command_storage->root;
-        command_storage = (::sw::CommandStorage*)flag;
+        if (flag > 1)
+        {
+            if constexpr (Ar::is_saving::value)
+                ar & command_storage->root;
+            else
+                ar & command_storage_root;
+        }
+        if constexpr (Ar::is_loading::value)
+            command_storage = flag > 1 ? nullptr : (::sw::CommandStorage*)flag;
 
         ar & first_response_file_argument;
         ar & always;
@@ -352,12 +409,20 @@ path resolveExecutable(const FilesOrdered &paths);
 // serialization
 
 // remember to set context and command storage after loading
+// dependencies between saved commands are kept, others are lost
 SW_BUILDER_API
 Commands loadCommands(const path &archive_fn, int type = 0);
 
 SW_BUILDER_API
 void saveCommands(const path &archive_fn, const Commands &, int type = 0);
 
+// several sets in one archive, commands present in many sets are saved once
+SW_BUILDER_API
+std::vector<Commands> loadCommandSets(const path &archive_fn, int type = 0);
+
+SW_BUILDER_API
+void saveCommandSets(const path &archive_fn, const std::vector<Commands> &, int type = 0);
+
 } // namespace sw
 
 namespace std
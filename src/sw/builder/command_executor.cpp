@@ -0,0 +1,140 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "command_executor.h"
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "executor");
+
+namespace sw
+{
+
+// worker of the current thread
+static thread_local const WorkStealingExecutor *current_executor;
+static thread_local size_t current_worker;
+
+WorkStealingExecutor::WorkStealingExecutor(size_t n_threads)
+{
+    if (n_threads == 0)
+        n_threads = 1;
+    workers.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; i++)
+        workers.push_back(std::make_unique<Worker>());
+    // start after all deques are created, workers steal from each other
+    for (size_t i = 0; i < n_threads; i++)
+        workers[i]->t = std::thread([this, i] { run(i); });
+}
+
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+    {
+        std::unique_lock lk(sleep_m);
+        stopped = true;
+    }
+    cv.notify_all();
+    for (auto &w : workers)
+        w->t.join();
+}
+
+void WorkStealingExecutor::push(Task t)
+{
+    auto i = current_executor == this ? current_worker : next_worker++ % workers.size();
+    {
+        std::unique_lock lk(workers[i]->m);
+        workers[i]->q.push_back(std::move(t));
+    }
+    n_tasks++;
+    // sleeping worker checks n_tasks after increasing n_sleeping,
+    // so one of us sees the other's increment
+    if (n_sleeping)
+    {
+        std::unique_lock lk(sleep_m);
+        cv.notify_one();
+    }
+}
+
+bool WorkStealingExecutor::pop(size_t i, Task &t)
+{
+    auto &w = *workers[i];
+    std::unique_lock lk(w.m);
+    if (w.q.empty())
+        return false;
+    t = std::move(w.q.back());
+    w.q.pop_back();
+    return true;
+}
+
+bool WorkStealingExecutor::steal(size_t i, Task &t)
+{
+    for (size_t k = 1; k < workers.size(); k++)
+    {
+        auto &w = *workers[(i + k) % workers.size()];
+        std::unique_lock lk(w.m, std::try_to_lock);
+        if (!lk.owns_lock() || w.q.empty())
+            continue;
+        t = std::move(w.q.front());
+        w.q.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingExecutor::run(size_t i)
+{
+    current_executor = this;
+    current_worker = i;
+
+    Task t;
+    while (1)
+    {
+        if (pop(i, t) || steal(i, t))
+        {
+            n_tasks--;
+            try
+            {
+                t();
+            }
+            catch (std::exception &e)
+            {
+                LOG_ERROR(logger, "task failed: " << e.what());
+            }
+            catch (...)
+            {
+                LOG_ERROR(logger, "task failed");
+            }
+            t = nullptr;
+            continue;
+        }
+
+        // steal() skips busy deques, so spin once more before sleeping
+        if (n_tasks)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock lk(sleep_m);
+        n_sleeping++;
+        cv.wait(lk, [this] { return n_tasks || stopped; });
+        n_sleeping--;
+        if (stopped && !n_tasks)
+            break;
+    }
+}
+
+}
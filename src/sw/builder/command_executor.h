@@ -0,0 +1,93 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/executor.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sw
+{
+
+/// executor interface used by execution plans
+struct SW_BUILDER_API CommandExecutor
+{
+    using Task = std::function<void()>;
+
+    virtual ~CommandExecutor() = default;
+
+    /// tasks must not throw
+    virtual void push(Task) = 0;
+    virtual size_t numberOfThreads() const = 0;
+};
+
+/// runs tasks on generic primitives executor
+struct SW_BUILDER_API GenericCommandExecutor : CommandExecutor
+{
+    GenericCommandExecutor(Executor &e) : e(e) {}
+
+    void push(Task t) override { e.push(std::move(t)); }
+    size_t numberOfThreads() const override { return e.numberOfThreads(); }
+
+private:
+    Executor &e;
+};
+
+/// thread pool with per-worker deques
+///
+/// Tasks pushed from a worker go to its own deque and are taken in lifo order
+/// (the most recent one is hot in caches), idle workers steal the oldest tasks
+/// from others. Tasks pushed from outside are distributed round-robin.
+struct SW_BUILDER_API WorkStealingExecutor : CommandExecutor
+{
+    WorkStealingExecutor(size_t n_threads = std::thread::hardware_concurrency());
+    WorkStealingExecutor(const WorkStealingExecutor &) = delete;
+    ~WorkStealingExecutor();
+
+    void push(Task) override;
+    size_t numberOfThreads() const override { return workers.size(); }
+
+private:
+    struct Worker
+    {
+        std::mutex m;
+        std::deque<Task> q;
+        std::thread t;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic_size_t n_tasks = 0;
+    std::atomic_size_t n_sleeping = 0;
+    std::atomic_size_t next_worker = 0;
+    std::atomic_bool stopped = false;
+    std::mutex sleep_m;
+    std::condition_variable cv;
+
+    void run(size_t i);
+    bool pop(size_t i, Task &);
+    bool steal(size_t i, Task &);
+};
+
+}
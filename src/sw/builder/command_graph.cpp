@@ -0,0 +1,207 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "command_graph.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace sw
+{
+
+IndexGraph IndexGraph::reversed() const
+{
+    IndexGraph r;
+    r.offsets.assign(size() + 1, 0);
+    r.edges.resize(edges.size());
+    for (auto e : edges)
+        r.offsets[e + 1]++;
+    for (size_t i = 0; i < size(); i++)
+        r.offsets[i + 1] += r.offsets[i];
+    auto pos = r.offsets;
+    for (uint32_t i = 0; i < size(); i++)
+    {
+        for (auto e = begin(i); e != end(i); e++)
+            r.edges[pos[*e]++] = i;
+    }
+    return r;
+}
+
+std::vector<uint32_t> getTopologicalOrder(const IndexGraph &g)
+{
+    auto dependents = g.reversed();
+
+    std::vector<uint32_t> left(g.size());
+    std::vector<uint32_t> order;
+    order.reserve(g.size());
+    for (uint32_t i = 0; i < g.size(); i++)
+    {
+        left[i] = g.degree(i);
+        if (!left[i])
+            order.push_back(i);
+    }
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        auto i = order[k];
+        for (auto d = dependents.begin(i); d != dependents.end(i); d++)
+        {
+            if (--left[*d] == 0)
+                order.push_back(*d);
+        }
+    }
+    return order;
+}
+
+std::vector<std::vector<uint32_t>> getCycles(const IndexGraph &g)
+{
+    const uint32_t unvisited = -1;
+
+    std::vector<std::vector<uint32_t>> cycles;
+    std::vector<uint32_t> index(g.size(), unvisited);
+    std::vector<uint32_t> low(g.size());
+    std::vector<bool> on_stack(g.size());
+    std::vector<uint32_t> stack;
+    // iterative dfs: node and position of the next edge to visit
+    std::vector<std::pair<uint32_t, const uint32_t *>> calls;
+    uint32_t next_index = 0;
+
+    for (uint32_t root = 0; root < g.size(); root++)
+    {
+        if (index[root] != unvisited)
+            continue;
+
+        calls.emplace_back(root, g.begin(root));
+        index[root] = low[root] = next_index++;
+        stack.push_back(root);
+        on_stack[root] = true;
+
+        while (!calls.empty())
+        {
+            auto &[v, e] = calls.back();
+            if (e != g.end(v))
+            {
+                auto w = *e++;
+                if (index[w] == unvisited)
+                {
+                    index[w] = low[w] = next_index++;
+                    stack.push_back(w);
+                    on_stack[w] = true;
+                    calls.emplace_back(w, g.begin(w)); // invalidates v, e
+                }
+                else if (on_stack[w])
+                    low[v] = std::min(low[v], index[w]);
+                continue;
+            }
+
+            auto u = v;
+            calls.pop_back();
+            if (!calls.empty())
+            {
+                auto p = calls.back().first;
+                low[p] = std::min(low[p], low[u]);
+            }
+            if (low[u] != index[u])
+                continue;
+
+            // u is the root of the component
+            std::vector<uint32_t> c;
+            uint32_t w;
+            do
+            {
+                w = stack.back();
+                stack.pop_back();
+                on_stack[w] = false;
+                c.push_back(w);
+            } while (w != u);
+            if (c.size() > 1 || std::find(g.begin(u), g.end(u), u) != g.end(u))
+                cycles.push_back(std::move(c));
+        }
+    }
+    return cycles;
+}
+
+IndexGraph getTransitiveReduction(const IndexGraph &g)
+{
+    auto order = getTopologicalOrder(g);
+    if (order.size() != g.size())
+        return g;
+
+    const uint32_t n = g.size();
+    std::vector<uint32_t> pos(n);
+    for (uint32_t p = 0; p < n; p++)
+        pos[order[p]] = p;
+
+    // reduced graph over topological positions,
+    // edges of every node go in descending order
+    IndexGraph r;
+    r.offsets.reserve(n + 1);
+    std::vector<uint32_t> mark(n, -1);
+    std::vector<uint32_t> deps, stack;
+    for (uint32_t p = 0; p < n; p++)
+    {
+        r.addNode();
+
+        auto v = order[p];
+        deps.clear();
+        for (auto d = g.begin(v); d != g.end(v); d++)
+            deps.push_back(pos[*d]);
+        // closest dependencies first, they may cover farther ones
+        std::sort(deps.begin(), deps.end(), std::greater<>());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+        if (deps.empty())
+            continue;
+
+        auto lowest = deps.back();
+        for (auto d : deps)
+        {
+            if (mark[d] == p)
+                continue; // reachable through other dependency
+            r.addEdge(d);
+            if (d == lowest)
+                break;
+
+            mark[d] = p;
+            stack.push_back(d);
+            while (!stack.empty())
+            {
+                auto u = stack.back();
+                stack.pop_back();
+                for (auto e = r.begin(u); e != r.end(u) && *e >= lowest; e++)
+                {
+                    if (mark[*e] == p)
+                        continue;
+                    mark[*e] = p;
+                    stack.push_back(*e);
+                }
+            }
+        }
+    }
+
+    IndexGraph tr;
+    tr.offsets.reserve(n + 1);
+    tr.edges.reserve(r.edges.size());
+    for (uint32_t v = 0; v < n; v++)
+    {
+        tr.addNode();
+        for (auto e = r.begin(pos[v]); e != r.end(pos[v]); e++)
+            tr.addEdge(order[*e]);
+    }
+    return tr;
+}
+
+}
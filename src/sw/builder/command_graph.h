@@ -0,0 +1,68 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sw
+{
+
+/// compact directed graph over dense node ids
+///
+/// Edges of node i are edges[offsets[i]] .. edges[offsets[i + 1] - 1].
+struct SW_BUILDER_API IndexGraph
+{
+    std::vector<uint32_t> offsets{ 0 };
+    std::vector<uint32_t> edges;
+
+    size_t size() const { return offsets.size() - 1; }
+    size_t degree(uint32_t i) const { return offsets[i + 1] - offsets[i]; }
+    const uint32_t *begin(uint32_t i) const { return edges.data() + offsets[i]; }
+    const uint32_t *end(uint32_t i) const { return edges.data() + offsets[i + 1]; }
+
+    /// edges of the next node are added until the next call
+    void addNode() { offsets.push_back(offsets.back()); }
+    void addEdge(uint32_t to) { edges.push_back(to); offsets.back()++; }
+
+    IndexGraph reversed() const;
+};
+
+/// Kahn's algorithm, graph edges point to dependencies
+///
+/// Returned order starts with nodes without dependencies.
+/// Nodes on cycles and nodes depending on them are not included.
+SW_BUILDER_API
+std::vector<uint32_t> getTopologicalOrder(const IndexGraph &);
+
+/// Tarjan's algorithm, returns strongly connected components
+/// having more than one node or a self loop
+SW_BUILDER_API
+std::vector<std::vector<uint32_t>> getCycles(const IndexGraph &);
+
+/// removes edges implied by longer paths, reachability is not changed
+///
+/// Graph must be acyclic, otherwise it is returned as is.
+/// Nodes are visited in topological order and every dfs is bounded
+/// by the farthest direct dependency of the current node.
+SW_BUILDER_API
+IndexGraph getTransitiveReduction(const IndexGraph &);
+
+}
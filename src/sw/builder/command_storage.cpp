@@ -18,11 +18,14 @@
 
 #include "command_storage.h"
 
+#include "file.h"
 #include "file_storage.h"
 #include "sw_context.h"
 
 #include <sw/manager/storage.h>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/thread/lock_types.hpp>
 #include <primitives/emitter.h>
 #include <primitives/executor.h>
@@ -32,10 +35,40 @@
 #include <primitives/lock.h>
 #include <primitives/symbol.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "db_file");
 
-#define COMMAND_DB_FORMAT_VERSION 4
+// 8: stable xxh3 keys of commands and files
+// 9: content hashes of command inputs
+// 10: content hashes of command outputs
+// 11: paths of implicit inputs are in command db
+#define COMMAND_DB_FORMAT_VERSION 11
+
+// command db layout, native endianness:
+//
+//  header
+//  slots[capacity], free slot has zero hash
+//  file slots[files_capacity], free slot has zero hash
+//  data[data_capacity]: history and implicit inputs of records, paths of files
+//
+// Updates are done in place under the storage lock: data goes to the free
+// space at the end, then slot is written. Records are rewritten in place
+// when they fit, otherwise their old space becomes garbage. Slots have
+// checksums over their data, so readers in other processes skip records
+// that are being written. The file is not resized in place, it is rebuilt
+// into a new one when tables or data are full or there is too much garbage.
+#define COMMAND_DB_MAGIC 0x42444353 // SCDB
+#define COMMAND_DB_VERSION 2
+
+// log is the delta of db, it is merged into db when it grows larger
+#define COMMAND_LOG_MERGE_SIZE (1024 * 1024)
 
 namespace sw
 {
@@ -60,6 +93,19 @@ static path getCommandsDbFilename(const path &root)
     return getDir(root) / std::to_string(COMMAND_DB_FORMAT_VERSION) / "commands.bin";
 }
 
+// keys of older formats are computed differently, their records are never found
+static void removeOldFormats(const path &root)
+{
+    error_code ec;
+    for (int v = 1; v < COMMAND_DB_FORMAT_VERSION; v++)
+        fs::remove_all(getDir(root) / std::to_string(v), ec);
+}
+
+static path getFileHashesFilename(const path &root)
+{
+    return getDir(root) / std::to_string(COMMAND_DB_FORMAT_VERSION) / "file_hashes.bin";
+}
+
 static path getCommandsLogFileName(const path &root)
 {
     auto cfg = shorten_hash(blake2b_512(getCurrentModuleNameHash()), 12);
@@ -83,45 +129,139 @@ static void write_str(std::vector<uint8_t> &vec, const String &val)
     memcpy(&vec[vsz], &val[0], sz);
 }
 
-Files CommandRecord::getImplicitInputs(detail::Storage &s) const
+void CommandRecord::setImplicitInputs(std::vector<FileId> files)
+{
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    // empty path
+    if (!files.empty() && files.front() == 0)
+        files.erase(files.begin());
+    implicit_inputs = std::move(files);
+}
+
+bool detail::FileIndex::insert(FileId id)
+{
+    auto h = getPathInterner().getHash(id);
+    // only one upgrade lock is held at a time, so check and insert are atomic
+    boost::upgrade_lock lk(m);
+    if (ids.find(h) != ids.end())
+        return false;
+    boost::upgrade_to_unique_lock lk2(lk);
+    ids.emplace(h, id);
+    return true;
+}
+
+FileId detail::FileIndex::find(uint64_t hash) const
+{
+    boost::shared_lock lk(m);
+    auto i = ids.find(hash);
+    return i == ids.end() ? 0 : i->second;
+}
+
+Hash128 detail::FileHashCache::get(FileId id, const fs::file_time_type &mtime)
 {
-    Files files;
-    for (auto &h : implicit_inputs)
+    auto &pi = getPathInterner();
+    auto p = pi.getPath(id);
+
+    Entry e;
+    e.path = pi.getHash(id);
+    e.mtime = mtime.time_since_epoch().count();
+#ifdef _WIN32
+    // file index requires an open handle, size and mtime are enough here
+    e.size = fs::file_size(p);
+#else
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0)
+        throw SW_RUNTIME_ERROR("Cannot stat file: " + normalize_path(p));
+    e.inode = st.st_ino;
+    e.size = st.st_size;
+#endif
+
     {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        if (!p.empty())
-            files.insert(p);
+        std::unique_lock lk(m);
+        auto i = entries.find(e.path);
+        if (i != entries.end() && i->second.inode == e.inode && i->second.size == e.size && i->second.mtime == e.mtime)
+            return i->second.hash;
     }
-    return files;
+
+    // hash outside of the lock
+    e.hash = hash128(read_file(p));
+
+    std::unique_lock lk(m);
+    entries[e.path] = e;
+    changed = true;
+    return e.hash;
 }
 
-void CommandRecord::setImplicitInputs(const Files &files, detail::Storage &s)
+void detail::FileHashCache::load(const path &fn)
 {
-    implicit_inputs.clear(); // clear first!
-
-    for (auto &f : files)
+    if (!fs::exists(fn))
+        return;
+    auto v = read_file(fn);
+    if (v.size() % sizeof(Entry))
+    {
+        LOG_WARN(logger, "File hashes db is corrupted, it will be recreated: " << normalize_path(fn));
+        return;
+    }
+    std::unique_lock lk(m);
+    entries.reserve(v.size() / sizeof(Entry));
+    for (size_t i = 0; i < v.size(); i += sizeof(Entry))
     {
-        auto str = normalize_path(f);
-        auto h = std::hash<String>()(str);
-        implicit_inputs.insert(h);
+        Entry e;
+        memcpy(&e, &v[i], sizeof(e));
+        entries[e.path] = e;
+    }
+}
 
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
+void detail::FileHashCache::save(const path &fn) const
+{
+    String v;
+    {
+        std::unique_lock lk(m);
+        v.resize(entries.size() * sizeof(Entry));
+        size_t i = 0;
+        for (auto &[_, e] : entries)
         {
-            boost::upgrade_to_unique_lock lk2(lk);
-            s.file_storage_by_hash[h] = fs::u8path(str);
+            memcpy(&v[i], &e, sizeof(e));
+            i += sizeof(e);
         }
     }
+    // write new file and replace the old one
+    auto tmp = path(fn) += ".tmp";
+    write_file(tmp, v);
+    fs::rename(tmp, fn);
+}
+
+void CommandRecord::addExecution(const CommandExecutionStats &s)
+{
+    if (history.size() == max_history)
+        history.pop_back();
+    history.insert(history.begin(), s);
+}
+
+uint64_t CommandRecord::getDuration() const
+{
+    if (history.empty())
+        return 0;
+    std::vector<uint32_t> v;
+    v.reserve(history.size());
+    for (auto &s : history)
+        v.push_back(s.wall);
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+uint64_t CommandRecord::getPeakRss() const
+{
+    uint64_t m = 0;
+    for (auto &s : history)
+        m = std::max<uint64_t>(m, s.peak_rss);
+    return m * 1024;
 }
 
 FileDb::FileDb(const SwBuilderContext &swctx)
     : swctx(swctx)
+    , log_merge_size(COMMAND_LOG_MERGE_SIZE)
 {
 }
 
@@ -137,19 +277,17 @@ void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f, const detail
 
     write_int(v, f.hash);
     write_int(v, f.mtime);
+    write_int(v, f.inputs_hash);
+    write_int(v, f.outputs_hash);
+
+    write_int(v, (uint8_t)f.history.size());
+    for (auto &s : f.history)
+        write_int(v, s);
 
     auto n = f.implicit_inputs.size();
     write_int(v, n);
-    for (auto &h : f.implicit_inputs)
-    {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        write_int(v, std::hash<String>()(normalize_path(p)));
-    }
+    for (auto id : f.implicit_inputs)
+        write_int(v, getPathInterner().getHash(id));
 }
 
 static String getFilesSuffix()
@@ -157,131 +295,142 @@ static String getFilesSuffix()
     return ".files";
 }
 
-static void load(const path &fn, Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands)
+static void loadFiles(const path &fn, detail::FileIndex &files)
 {
-    // files
-    if (fs::exists(path(fn) += getFilesSuffix()))
+    if (!fs::exists(fn))
+        return;
+
+    primitives::BinaryStream b;
+    b.load(fn);
+    while (!b.eof())
     {
-        primitives::BinaryStream b;
-        b.load(path(fn) += getFilesSuffix());
-        while (!b.eof())
+        size_t sz; // record size
+        b.read(sz);
+        if (!b.has(sz))
         {
-            size_t sz; // record size
-            b.read(sz);
-            if (!b.has(sz))
-            {
-                fs::resize_file(path(fn) += getFilesSuffix(), b.index() - sizeof(sz));
-                break; // record is in bad shape
-            }
-
-            if (sz == 0)
-                continue;
-
-            // file
-            String s;
-            b.read(s);
-            auto p = fs::u8path(s);
-            files.insert(p);
-
-            files2[std::hash<String>()(s)] = p;
+            fs::resize_file(fn, b.index() - sizeof(sz));
+            break; // record is in bad shape
         }
-    }
 
-    // commands
-    if (fs::exists(fn))
-    {
-        primitives::BinaryStream b;
-        b.load(fn);
-        while (!b.eof())
-        {
-            size_t sz; // record size
-            b.read(sz);
-            if (!b.has(sz))
-            {
-                fs::resize_file(path(fn) += getFilesSuffix(), b.index() - sizeof(sz));
-                break; // record is in bad shape
-            }
-
-            if (sz == 0)
-                continue;
+        if (sz == 0)
+            continue;
 
-            size_t h;
-            b.read(h);
-
-            auto r = commands.insert(h);
-            r.first->hash = h;
-
-            //if (!std::is_trivially_copyable_v<decltype(r.first->mtime)>)
-                //throw SW_RUNTIME_ERROR("x");
-
-            b.read(r.first->mtime);
-
-            size_t n;
-            b.read(n);
-            r.first->implicit_inputs.reserve(n);
-            while (n--)
-            {
-                b.read(h);
-                auto &f = files2[h];
-                if (!f.empty())
-                {
-                    //r.first->implicit_inputs.insert(files2[h]);
-                    r.first->implicit_inputs.insert(h);
-                }
-            }
-        }
+        // file
+        String s;
+        b.read(s);
+        files.insert(getPathInterner().internNormalized(s));
     }
 }
 
-void FileDb::load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, const path &root) const
+// returns number of loaded records
+static size_t loadCommands(const path &fn, const detail::FileIndex &files, ConcurrentCommandStorage &commands)
 {
-    sw::load(getCommandsDbFilename(root), files, files2, commands);
-    sw::load(getCommandsLogFileName(root), files, files2, commands);
-}
+    if (!fs::exists(fn))
+        return 0;
 
-void FileDb::save(const Files &files, const detail::Storage &s, ConcurrentCommandStorage &commands, const path &root) const
-{
-    std::vector<uint8_t> v;
-
-    // files
+    size_t n_records = 0;
+    primitives::BinaryStream b;
+    b.load(fn);
+    while (!b.eof())
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (auto &f : files)
-        {
-            auto s = normalize_path(f);
-            auto sz = s.size() + 1;
-            b.write(sz);
-            b.write(s);
-        }
-        if (!b.empty())
+        size_t sz; // record size
+        b.read(sz);
+        if (!b.has(sz))
         {
-            auto p = getCommandsDbFilename(root) += getFilesSuffix();
-            fs::create_directories(p.parent_path());
-            b.save(p);
+            fs::resize_file(fn, b.index() - sizeof(sz));
+            break; // record is in bad shape
         }
-    }
 
-    // commands
-    {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (const auto &[k, r] : commands)
+        if (sz == 0)
+            continue;
+
+        size_t h;
+        b.read(h);
+
+        auto r = commands.insert(h);
+        r.first->hash = h;
+        r.first->dirty = true;
+
+        //if (!std::is_trivially_copyable_v<decltype(r.first->mtime)>)
+            //throw SW_RUNTIME_ERROR("x");
+
+        b.read(r.first->mtime);
+        b.read(r.first->inputs_hash);
+        b.read(r.first->outputs_hash);
+
+        uint8_t nh;
+        b.read(nh);
+        r.first->history.resize(nh);
+        for (auto &s : r.first->history)
+            b.read(s);
+
+        size_t n;
+        b.read(n);
+        std::vector<FileId> implicit_inputs;
+        implicit_inputs.reserve(n);
+        bool outdated = false;
+        while (n--)
         {
-            write(v, r, s);
-            auto sz = v.size();
-            b.write(sz);
-            b.write(v.data(), v.size());
+            uint64_t fh;
+            b.read(fh);
+            if (auto id = files.find(fh))
+                implicit_inputs.push_back(id);
+            else
+                outdated = true;
         }
-        if (!b.empty())
+        if (outdated)
         {
-            auto p = getCommandsDbFilename(root);
-            fs::create_directories(p.parent_path());
-            b.save(p);
+            // record without some of its inputs would look up to date,
+            // older record from db must not be used too
+            r.first->mtime = fs::file_time_type::min();
+            r.first->inputs_hash = {};
+            implicit_inputs.clear();
         }
+        r.first->setImplicitInputs(std::move(implicit_inputs));
+        n_records++;
     }
+    return n_records;
+}
+
+bool FileDb::load(detail::Storage &s, const path &root) const
+{
+    s.db = std::make_unique<detail::CommandDb>(getCommandsDbFilename(root));
+
+    // records not merged into db yet
+    auto log = getCommandsLogFileName(root);
+    loadFiles(path(log) += getFilesSuffix(), s.files);
+    return loadCommands(log, s.files, s.storage);
+}
+
+void FileDb::save(detail::Storage &s, const path &root) const
+{
+    auto fn = getCommandsDbFilename(root);
+    fs::create_directories(fn.parent_path());
+    auto log = getCommandsLogFileName(root);
+
+    if (!s.db->exists())
+        removeOldFormats(root);
+
+    if (s.hashes.isChanged())
+        s.hashes.save(getFileHashesFilename(root));
 
+    // all dirty records are in the log, small log stays as is
     error_code ec;
-    fs::remove(getCommandsLogFileName(root), ec);
-    fs::remove(getCommandsLogFileName(root) += getFilesSuffix(), ec);
+    auto log_size = fs::file_size(log, ec);
+    if (ec || log_size < log_merge_size)
+        return;
+
+    std::vector<const CommandRecord *> records;
+    for (const auto &[k, r] : s.storage)
+    {
+        if (r.dirty && r.hash)
+            records.push_back(&r);
+    }
+    // records stay in the log and are replayed by the next build
+    if (!s.db->update(records))
+        return;
+    fs::remove(log, ec);
+    fs::remove(path(log) += getFilesSuffix(), ec);
 }
 
 detail::FileHolder::FileHolder(const path &fn)
@@ -301,10 +450,544 @@ detail::FileHolder::FileHolder(const path &fn)
 
 detail::FileHolder::~FileHolder()
 {
+    // log is removed after its records are saved into db (FileDb::save()),
+    // so it is still here after a crash
     f.close();
+}
+
+detail::CommandLog::CommandLog(const path &fn, FileIndex &files_index, bool sync)
+    : fn(fn)
+    , files_index(files_index)
+    , sync(sync)
+{
+}
+
+detail::CommandLog::~CommandLog()
+{
+    flush();
+}
+
+bool detail::CommandLog::push(std::vector<uint8_t> command, std::vector<FileId> implicit_inputs)
+{
+    auto r = new Record;
+    r->command = std::move(command);
+    r->implicit_inputs = std::move(implicit_inputs);
+    r->next = head.load();
+    while (!head.compare_exchange_weak(r->next, r))
+        ;
+    return !r->next;
+}
+
+static void append(detail::FileHolder &h, const std::vector<uint8_t> &v, bool sync)
+{
+    if (v.empty())
+        return;
+    auto f = h.f.getHandle();
+    if (fwrite(v.data(), v.size(), 1, f) != 1 || fflush(f) != 0)
+        throw SW_RUNTIME_ERROR("Cannot write command log: " + normalize_path(h.fn));
+    if (!sync)
+        return;
+#ifdef _WIN32
+    if (_commit(_fileno(f)) != 0)
+#else
+    if (fsync(fileno(f)) != 0)
+#endif
+        throw SW_RUNTIME_ERROR("Cannot sync command log: " + normalize_path(h.fn));
+}
+
+void detail::CommandLog::flush()
+{
+    std::unique_lock lk(m);
+
+    // take the whole list and restore push order
+    Record *r = nullptr;
+    for (auto p = head.exchange(nullptr); p;)
+    {
+        auto next = p->next;
+        p->next = r;
+        r = p;
+        p = next;
+    }
+    if (!r)
+        return;
+
+    std::vector<uint8_t> cv, fv;
+    while (r)
+    {
+        std::unique_ptr<Record> p(r);
+        r = r->next;
+
+        write_int(cv, p->command.size());
+        cv.insert(cv.end(), p->command.begin(), p->command.end());
+
+        for (auto id : p->implicit_inputs)
+        {
+            if (!files_index.insert(id))
+                continue;
+            auto &s = getPathInterner().getString(id);
+            write_int(fv, s.size() + 1);
+            write_str(fv, s);
+        }
+    }
+
+    if (!commands)
+        commands = std::make_unique<FileHolder>(fn);
+    if (!files)
+        files = std::make_unique<FileHolder>(path(fn) += getFilesSuffix());
+
+    // files go first, commands refer to them
+    append(*files, fv, sync);
+    append(*commands, cv, sync);
+}
+
+namespace
+{
+
+struct CommandDbHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; // command slots, power of 2
+    uint64_t size;
+    uint64_t files_capacity; // file slots, power of 2
+    uint64_t files_size;
+    uint64_t data_capacity;
+    uint64_t data_size; // used
+    uint64_t garbage; // in used data, left by moved records
+};
+
+struct CommandDbSlot
+{
+    uint64_t hash;
+    int64_t mtime;
+    Hash128 inputs_hash;
+    Hash128 outputs_hash;
+    uint64_t offset; // in data
+    uint32_t space; // bytes available at offset
+    uint32_t n_history;
+    uint32_t n_inputs;
+    uint32_t reserved;
+    // fields above and record data, readers skip slots that are being written
+    uint64_t check;
+};
+
+// implicit inputs are stored as path hashes, paths are in file table
+struct CommandDbFileSlot
+{
+    uint64_t hash; // hash64() of path
+    uint64_t offset; // in data
+    uint64_t size;
+};
 
-    error_code ec; // remove ec? but multiple processes may be writing into this log? or not?
-    fs::remove(fn, ec);
+static_assert(sizeof(fs::file_time_type::duration::rep) <= sizeof(int64_t));
+
+size_t getSlotIndex(uint64_t hash, uint64_t capacity)
+{
+    // mix hash, low bits of command hashes are not always good
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return (hash ^ (hash >> 32)) & (capacity - 1);
+}
+
+uint64_t getFileSlotsOffset(const CommandDbHeader &h)
+{
+    return sizeof(CommandDbHeader) + h.capacity * sizeof(CommandDbSlot);
+}
+
+uint64_t getDataOffset(const CommandDbHeader &h)
+{
+    return getFileSlotsOffset(h) + h.files_capacity * sizeof(CommandDbFileSlot);
+}
+
+uint64_t getDataSize(uint64_t n_history, uint64_t n_inputs)
+{
+    return n_history * sizeof(CommandExecutionStats) + n_inputs * sizeof(uint64_t);
+}
+
+size_t getDataSize(const CommandRecord &r)
+{
+    return getDataSize(r.history.size(), r.implicit_inputs.size());
+}
+
+// history grows up to its max size in place
+size_t getSpace(const CommandRecord &r)
+{
+    return getDataSize(CommandRecord::max_history, r.implicit_inputs.size());
+}
+
+uint64_t getCheck(const CommandDbSlot &s, const uint8_t *data)
+{
+    auto h = hash64(std::string_view((const char *)&s, offsetof(CommandDbSlot, check)));
+    auto dh = hash64(std::string_view((const char *)data, getDataSize(s.n_history, s.n_inputs)));
+    return h ^ (dh * 0x9E3779B97F4A7C15ULL);
+}
+
+void writeData(uint8_t *d, const CommandRecord &r)
+{
+    if (!r.history.empty())
+        memcpy(d, r.history.data(), r.history.size() * sizeof(CommandExecutionStats));
+    d += r.history.size() * sizeof(CommandExecutionStats);
+    for (auto id : r.implicit_inputs)
+    {
+        uint64_t h = getPathInterner().getHash(id);
+        memcpy(d, &h, sizeof(h));
+        d += sizeof(h);
+    }
+}
+
+void setSlot(CommandDbSlot &s, const CommandRecord &r)
+{
+    s.mtime = r.mtime.time_since_epoch().count();
+    s.inputs_hash = r.inputs_hash;
+    s.outputs_hash = r.outputs_hash;
+    s.n_history = r.history.size();
+    s.n_inputs = r.implicit_inputs.size();
+}
+
+// returns free slot if hash is missing
+template <class Slot>
+Slot *findSlot(Slot *slots, uint64_t capacity, uint64_t hash)
+{
+    for (uint64_t i = getSlotIndex(hash, capacity), n = 0; n < capacity; i = (i + 1) & (capacity - 1), n++)
+    {
+        if (!slots[i].hash || slots[i].hash == hash)
+            return &slots[i];
+    }
+    return nullptr;
+}
+
+// compaction happens when tables are filled by 3/4 or half of data is garbage
+bool isFull(uint64_t size, uint64_t capacity)
+{
+    return size * 4 > capacity * 3;
+}
+
+// new file, tables are filled by at most 1/2 and data by at most 1/2
+CommandDbHeader makeHeader(uint64_t size, uint64_t files_size, uint64_t data_size)
+{
+    CommandDbHeader h{};
+    h.magic = COMMAND_DB_MAGIC;
+    h.version = COMMAND_DB_VERSION;
+    h.capacity = 1024;
+    while (h.capacity < size * 2)
+        h.capacity *= 2;
+    h.files_capacity = 1024;
+    while (h.files_capacity < files_size * 2)
+        h.files_capacity *= 2;
+    h.data_capacity = std::max<uint64_t>(data_size * 2, 1024 * 1024);
+    return h;
+}
+
+}
+
+struct detail::CommandDb::Mapping
+{
+    boost::interprocess::file_mapping fm;
+    boost::interprocess::mapped_region r;
+
+    Mapping(const path &p, boost::interprocess::mode_t mode)
+        : fm(p.string().c_str(), mode)
+        , r(fm, mode)
+    {
+    }
+
+    uint8_t *data() const { return (uint8_t *)r.get_address(); }
+    CommandDbHeader &header() const { return *(CommandDbHeader *)data(); }
+    CommandDbSlot *slots() const { return (CommandDbSlot *)(data() + sizeof(CommandDbHeader)); }
+    CommandDbFileSlot *fileSlots() const { return (CommandDbFileSlot *)(data() + getFileSlotsOffset(header())); }
+    uint8_t *recordData() const { return data() + getDataOffset(header()); }
+};
+
+detail::CommandDb::CommandDb(const path &fn)
+    : fn(fn)
+{
+    map(false);
+}
+
+detail::CommandDb::~CommandDb()
+{
+}
+
+void detail::CommandDb::map(bool write)
+{
+    mapping.reset();
+
+    error_code ec;
+    auto sz = fs::file_size(fn, ec);
+    if (ec || sz < sizeof(CommandDbHeader))
+        return;
+
+    auto m = std::make_unique<Mapping>(fn, write ? boost::interprocess::read_write : boost::interprocess::read_only);
+    auto &h = m->header();
+    if (h.magic != COMMAND_DB_MAGIC || h.version != COMMAND_DB_VERSION ||
+        !h.capacity || (h.capacity & (h.capacity - 1)) || h.size >= h.capacity ||
+        !h.files_capacity || (h.files_capacity & (h.files_capacity - 1)) || h.files_size >= h.files_capacity ||
+        h.data_size > h.data_capacity || sz < getDataOffset(h) + h.data_capacity)
+    {
+        LOG_WARN(logger, "Command db is corrupted, it will be recreated: " << normalize_path(fn));
+        return;
+    }
+    mapping = std::move(m);
+}
+
+size_t detail::CommandDb::size() const
+{
+    return mapping ? mapping->header().size : 0;
+}
+
+FileId detail::CommandDb::findFile(uint64_t hash) const
+{
+    auto &h = mapping->header();
+    auto s = findSlot(mapping->fileSlots(), h.files_capacity, hash);
+    if (!s || s->hash != hash)
+        return 0;
+    CommandDbFileSlot fs = *s;
+    if (fs.offset > h.data_size || fs.size > h.data_size - fs.offset)
+        return 0;
+    std::string_view p((const char *)mapping->recordData() + fs.offset, fs.size);
+    // slot is being written by other process
+    if (hash64(p) != hash)
+        return 0;
+    return getPathInterner().internNormalized(String(p));
+}
+
+bool detail::CommandDb::find(size_t hash, CommandRecord &r) const
+{
+    if (!mapping || !hash)
+        return false;
+
+    auto &h = mapping->header();
+    auto ps = findSlot(mapping->slots(), h.capacity, hash);
+    if (!ps || ps->hash != hash)
+        return false;
+    // other processes may update the slot in place, work with a copy
+    CommandDbSlot s = *ps;
+    if (s.n_history > CommandRecord::max_history || s.offset > h.data_size ||
+        getDataSize(s.n_history, s.n_inputs) > h.data_size - s.offset)
+        return false;
+    auto d = mapping->recordData() + s.offset;
+    if (getCheck(s, d) != s.check)
+        return false;
+
+    r.hash = hash;
+    r.mtime = fs::file_time_type(fs::file_time_type::duration(s.mtime));
+    r.inputs_hash = s.inputs_hash;
+    r.outputs_hash = s.outputs_hash;
+    r.history.resize(s.n_history);
+    if (s.n_history)
+        memcpy(r.history.data(), d, s.n_history * sizeof(CommandExecutionStats));
+    d += s.n_history * sizeof(CommandExecutionStats);
+    std::vector<FileId> implicit_inputs;
+    implicit_inputs.reserve(s.n_inputs);
+    for (uint32_t i = 0; i < s.n_inputs; i++, d += sizeof(uint64_t))
+    {
+        uint64_t f;
+        memcpy(&f, d, sizeof(f));
+        // record without some of its inputs would look up to date
+        auto id = findFile(f);
+        if (!id)
+            return false;
+        implicit_inputs.push_back(id);
+    }
+    // ids are different in every process
+    r.setImplicitInputs(std::move(implicit_inputs));
+    return true;
+}
+
+bool detail::CommandDb::update(const std::vector<const CommandRecord *> &records)
+{
+    if (records.empty())
+        return true;
+    // other processes might have changed or replaced the db since we mapped it
+    map(true);
+    if (mapping && merge(records))
+        return true;
+    return rebuild(records);
+}
+
+bool detail::CommandDb::merge(const std::vector<const CommandRecord *> &records)
+{
+    auto &h = mapping->header();
+
+    // check that everything fits first, so the file is not left half updated
+    std::unordered_map<uint64_t, FileId> new_files;
+    uint64_t new_records = 0, data_size = 0, garbage = 0;
+    for (auto r : records)
+    {
+        auto s = findSlot(mapping->slots(), h.capacity, r->hash);
+        if (!s)
+            return false;
+        if (!s->hash)
+        {
+            new_records++;
+            data_size += getSpace(*r);
+        }
+        else if (s->space < getDataSize(*r))
+        {
+            garbage += s->space;
+            data_size += getSpace(*r);
+        }
+        for (auto id : r->implicit_inputs)
+        {
+            auto fh = getPathInterner().getHash(id);
+            auto fs = findSlot(mapping->fileSlots(), h.files_capacity, fh);
+            if (!fs)
+                return false;
+            if (!fs->hash && new_files.emplace(fh, id).second)
+                data_size += getPathInterner().getString(id).size();
+        }
+    }
+    if (isFull(h.size + new_records, h.capacity) ||
+        isFull(h.files_size + new_files.size(), h.files_capacity) ||
+        h.data_size + data_size > h.data_capacity ||
+        (h.garbage + garbage) * 2 > h.data_capacity)
+        return false;
+
+    // readers in other processes see complete data before slots point to it
+    auto append = [this, &h](const void *p, uint64_t sz)
+    {
+        auto offset = h.data_size;
+        memcpy(mapping->recordData() + offset, p, sz);
+        std::atomic_thread_fence(std::memory_order_release);
+        h.data_size += sz;
+        return offset;
+    };
+
+    for (auto &[fh, id] : new_files)
+    {
+        auto &p = getPathInterner().getString(id);
+        auto s = findSlot(mapping->fileSlots(), h.files_capacity, fh);
+        s->offset = append(p.data(), p.size());
+        s->size = p.size();
+        std::atomic_thread_fence(std::memory_order_release);
+        s->hash = fh;
+        h.files_size++;
+    }
+
+    std::vector<uint8_t> data;
+    for (auto r : records)
+    {
+        data.resize(getDataSize(*r));
+        writeData(data.data(), *r);
+
+        auto s = findSlot(mapping->slots(), h.capacity, r->hash);
+        CommandDbSlot ns{};
+        ns.hash = r->hash;
+        if (s->hash && s->space >= data.size())
+        {
+            // rewrite in place
+            ns.offset = s->offset;
+            ns.space = s->space;
+            memcpy(mapping->recordData() + ns.offset, data.data(), data.size());
+        }
+        else
+        {
+            if (s->hash)
+                h.garbage += s->space;
+            else
+                h.size++;
+            std::vector<uint8_t> space(getSpace(*r));
+            memcpy(space.data(), data.data(), data.size());
+            ns.offset = append(space.data(), space.size());
+            ns.space = space.size();
+        }
+        setSlot(ns, *r);
+        ns.check = getCheck(ns, data.data());
+        std::atomic_thread_fence(std::memory_order_release);
+        *s = ns;
+    }
+    return true;
+}
+
+bool detail::CommandDb::rebuild(const std::vector<const CommandRecord *> &records)
+{
+    std::unordered_map<uint64_t, const CommandRecord *> updates;
+    for (auto r : records)
+        updates[r->hash] = r;
+
+    // old records without updates and their files
+    std::vector<CommandRecord> old;
+    if (mapping)
+    {
+        auto &h = mapping->header();
+        for (uint64_t i = 0; i < h.capacity; i++)
+        {
+            auto &s = mapping->slots()[i];
+            if (!s.hash || updates.find(s.hash) != updates.end())
+                continue;
+            CommandRecord r;
+            if (find(s.hash, r))
+                old.push_back(std::move(r));
+        }
+    }
+
+    // only files of live records are kept
+    std::unordered_map<uint64_t, FileId> files;
+    uint64_t data_size = 0;
+    auto add_record = [&files, &data_size](const CommandRecord &r)
+    {
+        data_size += getSpace(r);
+        for (auto id : r.implicit_inputs)
+        {
+            if (files.emplace(getPathInterner().getHash(id), id).second)
+                data_size += getPathInterner().getString(id).size();
+        }
+    };
+    for (auto &r : old)
+        add_record(r);
+    for (auto &[_, r] : updates)
+        add_record(*r);
+
+    auto h = makeHeader(old.size() + updates.size(), files.size(), data_size);
+    String v(getDataOffset(h) + h.data_capacity, 0);
+    auto out = (uint8_t *)v.data();
+    auto slots = (CommandDbSlot *)(out + sizeof(CommandDbHeader));
+    auto file_slots = (CommandDbFileSlot *)(out + getFileSlotsOffset(h));
+    auto data = out + getDataOffset(h);
+    for (auto &[fh, id] : files)
+    {
+        auto &p = getPathInterner().getString(id);
+        auto s = findSlot(file_slots, h.files_capacity, fh);
+        s->hash = fh;
+        s->offset = h.data_size;
+        s->size = p.size();
+        memcpy(data + s->offset, p.data(), p.size());
+        h.data_size += p.size();
+        h.files_size++;
+    }
+    auto write_record = [&h, slots, data](const CommandRecord &r)
+    {
+        auto s = findSlot(slots, h.capacity, r.hash);
+        s->hash = r.hash;
+        s->offset = h.data_size;
+        s->space = getSpace(r);
+        setSlot(*s, r);
+        writeData(data + s->offset, r);
+        s->check = getCheck(*s, data + s->offset);
+        h.data_size += s->space;
+        h.size++;
+    };
+    for (auto &r : old)
+        write_record(r);
+    for (auto &[_, r] : updates)
+        write_record(*r);
+    memcpy(out, &h, sizeof(h));
+
+    // write new file and replace the old one
+    auto tmp = path(fn) += ".tmp";
+    write_file(tmp, v);
+    mapping.reset();
+    error_code ec;
+    fs::rename(tmp, fn, ec);
+    if (ec)
+    {
+        // windows does not replace files mapped by other processes
+        LOG_DEBUG(logger, "Cannot replace command db " << normalize_path(fn) << ": " << ec.message());
+        fs::remove(tmp, ec);
+        map(false);
+        return false;
+    }
+    map(false);
+    return true;
 }
 
 CommandStorage::CommandStorage(const SwBuilderContext &swctx, const path &root)
@@ -321,79 +1004,56 @@ CommandStorage::~CommandStorage()
     save();
 }
 
-void CommandStorage::async_command_log(const CommandRecord &r)
+void CommandStorage::async_command_log(CommandRecord &r)
 {
-    static std::vector<uint8_t> v;
+    auto &s = getInternalStorage();
+    r.dirty = true;
+
+    // record is serialized now, it may be changed by the next execution
+    std::vector<uint8_t> v;
+    fdb.write(v, r, s);
 
     changed = true;
-    add_user();
-    swctx.getFileStorageExecutor().push([this, &r]
+    auto &log = s.getLog(swctx, root);
+    if (!log->push(std::move(v), r.implicit_inputs))
+        return; // flush is already scheduled
+    swctx.getFileStorageExecutor().push([log]
     {
-        auto &s = getInternalStorage();
-
+        try
         {
-            // write record to vector v
-            fdb.write(v, r, s);
-
-            auto &l = s.getCommandLog(swctx, root);
-            auto sz = v.size();
-            fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
-            fwrite(&v[0], sz, 1, l.f.getHandle());
-            fflush(l.f.getHandle());
+            log->flush();
         }
-
+        catch (std::exception &e)
         {
-            auto &l = s.getFileLog(swctx, root);
-            for (auto &f : r.getImplicitInputs(s))
-            {
-                auto r = s.file_storage.insert(f);
-                if (!r.second)
-                    continue;
-                auto s = normalize_path(f);
-                auto sz = s.size() + 1;
-                fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
-                fwrite(&s[0], sz, 1, l.f.getHandle());
-                fflush(l.f.getHandle());
-            }
+            LOG_ERROR(logger, e.what());
         }
-
-        free_user();
     });
 }
 
-void CommandStorage::add_user()
-{
-    //++n_users;
-}
-
-void CommandStorage::free_user()
-{
-    //--n_users;
-    //if (n_users == 0)
-        closeLogs(); // reduce number of open fds
-}
-
 void detail::Storage::closeLogs()
 {
-    commands.reset();
-    files.reset();
+    if (!log)
+        return;
+    // scheduled flushes may still hold the log, but they have nothing to write
+    log->flush();
+    log.reset();
 }
 
 void CommandStorage::closeLogs()
 {
     s.closeLogs();
-    //save();
 }
 
 void CommandStorage::save()
 {
-    if (!changed)
+    if (!changed && !s.hashes.isChanged())
         return;
     if (saved)
         return;
     // and save at the end
     try
     {
+        closeLogs();
         save1();
         saved = true;
     }
@@ -404,28 +1064,26 @@ void CommandStorage::save()
     lock.reset();
 }
 
-detail::FileHolder &detail::Storage::getCommandLog(const SwBuilderContext &swctx, const path &root)
+const std::shared_ptr<detail::CommandLog> &detail::Storage::getLog(const SwBuilderContext &swctx, const path &root)
 {
-    if (!commands)
-        commands = std::make_unique<FileHolder>(getCommandsLogFileName(root));
-    return *commands;
-}
-
-detail::FileHolder &detail::Storage::getFileLog(const SwBuilderContext &swctx, const path &root)
-{
-    if (!files)
-        files = std::make_unique<FileHolder>(getCommandsLogFileName(root) += getFilesSuffix());
-    return *files;
+    std::call_once(log_created, [this, &swctx, &root]
+    {
+        log = std::make_shared<CommandLog>(getCommandsLogFileName(root), files, swctx.sync_command_log);
+    });
+    return log;
 }
 
 void CommandStorage::load()
 {
-    fdb.load(s.file_storage, s.file_storage_by_hash, s.storage, root);
+    changed = fdb.load(s, root);
 }
 
 void CommandStorage::save1()
 {
-    fdb.save(s.file_storage, s, s.storage, root);
+    // db and its files are shared with other processes using the same storage
+    fs::create_directories(root);
+    auto lk = getLock();
+    fdb.save(s, root);
 }
 
 ConcurrentCommandStorage &CommandStorage::getStorage()
@@ -440,9 +1098,44 @@ detail::Storage &CommandStorage::getInternalStorage()
 
 std::pair<CommandRecord *, bool> CommandStorage::insert(size_t hash)
 {
+    if (auto r = find(hash))
+        return { r, false };
     return getStorage().insert(hash);
 }
 
+Hash128 CommandStorage::getContentHash(File &f)
+{
+    std::call_once(s.hashes_loaded, [this]
+    {
+        s.hashes.load(getFileHashesFilename(root));
+    });
+
+    f.isChanged();
+    auto &d = f.getFileData();
+    if (d.last_write_time == fs::file_time_type::min())
+        return {}; // missing
+    // other commands wait for the same file instead of hashing it again
+    std::unique_lock lk(d.content_hash_mutex);
+    if (d.content_hash_time != d.last_write_time || !d.content_hash)
+    {
+        d.content_hash = s.hashes.get(getPathInterner().intern(f.file), d.last_write_time);
+        d.content_hash_time = d.last_write_time;
+    }
+    return d.content_hash;
+}
+
+CommandRecord *CommandStorage::find(size_t hash)
+{
+    if (auto r = s.storage.find(hash))
+        return r;
+
+    CommandRecord r;
+    if (!s.db || !s.db->find(hash, r))
+        return nullptr;
+    // concurrent lookups get the same record
+    return s.storage.insert(hash, r).first;
+}
+
 path CommandStorage::getLockFileName() const
 {
     return root / "build";
@@ -19,23 +19,67 @@
 #pragma once
 
 #include "concurrent_map.h"
+#include "path_interner.h"
+
+#include <sw/support/hash.h>
 
 #include <boost/thread/shared_mutex.hpp>
 #include <primitives/lock.h>
 #include <primitives/templates.h>
 
 #include <atomic>
+#include <mutex>
 
 namespace sw
 {
 
+struct CommandRecord;
 struct CommandStorage;
+struct File;
 
 namespace detail
 {
 
 struct Storage;
 
+/// files of the command log, files of db are resolved on lookup
+struct FileIndex
+{
+    mutable boost::upgrade_mutex m;
+    // path hash -> id
+    std::unordered_map<uint64_t, FileId> ids;
+
+    /// returns false if file is already known
+    bool insert(FileId);
+    /// returns 0 if file is unknown
+    FileId find(uint64_t hash) const;
+};
+
+/// content hashes of files, valid while their inode, size and mtime are the same
+struct FileHashCache
+{
+    struct Entry
+    {
+        uint64_t path = 0; // hash
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        Hash128 hash;
+    };
+
+    /// reads and hashes file when it is missing or outdated
+    Hash128 get(FileId, const fs::file_time_type &mtime);
+
+    void load(const path &fn);
+    void save(const path &fn) const;
+    bool isChanged() const { return changed; }
+
+private:
+    mutable std::mutex m;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::atomic_bool changed{ false };
+};
+
 struct FileHolder
 {
     ScopedFile f;
@@ -45,17 +89,109 @@ struct FileHolder
     ~FileHolder();
 };
 
+/// group commit log of command records
+///
+/// Records are pushed into lock-free list. The first record of a batch
+/// schedules flush on the log writer thread, flush takes all records gathered
+/// so far and appends them to the log files with one write per file.
+/// Files stay open until the log is destroyed.
+struct CommandLog
+{
+    CommandLog(const path &fn, FileIndex &files_index, bool sync);
+    CommandLog(const CommandLog &) = delete;
+    CommandLog &operator=(const CommandLog &) = delete;
+    ~CommandLog();
+
+    /// returns true if the record starts new batch and flush must be scheduled
+    bool push(std::vector<uint8_t> command, std::vector<FileId> implicit_inputs);
+    void flush();
+
+private:
+    struct Record
+    {
+        Record *next = nullptr;
+        std::vector<uint8_t> command;
+        std::vector<FileId> implicit_inputs;
+    };
+
+    path fn;
+    // new implicit inputs are written to the files log,
+    // only touched when there are records to write
+    FileIndex &files_index;
+    bool sync;
+    std::atomic<Record *> head{ nullptr };
+    std::mutex m; // one writer at a time
+    std::unique_ptr<FileHolder> commands;
+    std::unique_ptr<FileHolder> files;
+};
+
+/// mapped on-disk hash table of command records and paths of their inputs
+///
+/// Records are read in place, only records used by the build are loaded
+/// and only their paths are interned. Updates are merged in place,
+/// the file is rebuilt only when it is full or has too much garbage.
+struct CommandDb
+{
+    CommandDb(const path &fn);
+    CommandDb(const CommandDb &) = delete;
+    CommandDb &operator=(const CommandDb &) = delete;
+    ~CommandDb();
+
+    bool exists() const { return !!mapping; }
+    size_t size() const;
+    /// returns false for records being written and records with unknown inputs
+    bool find(size_t hash, CommandRecord &) const;
+    /// must be called under the storage lock,
+    /// returns false if the db must be rebuilt but is in use and cannot be replaced
+    bool update(const std::vector<const CommandRecord *> &);
+
+private:
+    struct Mapping;
+
+    path fn;
+    std::unique_ptr<Mapping> mapping;
+
+    void map(bool write);
+    FileId findFile(uint64_t hash) const;
+    bool merge(const std::vector<const CommandRecord *> &);
+    bool rebuild(const std::vector<const CommandRecord *> &);
+};
+
 }
 
+/// resources used by one command execution
+struct CommandExecutionStats
+{
+    uint32_t wall = 0; // us
+    uint32_t user = 0; // us
+    uint32_t sys = 0; // us
+    uint32_t peak_rss = 0; // KB, 0 = unknown
+};
+
 struct CommandRecord
 {
+    static constexpr size_t max_history = 8;
+
     size_t hash = 0;
     fs::file_time_type mtime = fs::file_time_type::min();
-    //Files implicit_inputs;
-    std::unordered_set<size_t> implicit_inputs;
+    // last executions, newest first
+    std::vector<CommandExecutionStats> history;
+    // sorted
+    std::vector<FileId> implicit_inputs;
+    // content of inputs and implicit inputs, zero = unknown
+    Hash128 inputs_hash;
+    // content of outputs after the last execution, zero = unknown
+    Hash128 outputs_hash;
+    // changed during this build or loaded from log, must be written into db
+    bool dirty = false;
 
-    Files getImplicitInputs(detail::Storage &) const;
-    void setImplicitInputs(const Files &, detail::Storage &);
+    void setImplicitInputs(std::vector<FileId>);
+
+    void addExecution(const CommandExecutionStats &);
+    /// median wall time of recorded executions, us, 0 = unknown
+    uint64_t getDuration() const;
+    /// max peak rss of recorded executions, bytes, 0 = unknown
+    uint64_t getPeakRss() const;
 };
 
 using ConcurrentCommandStorage = ConcurrentMap<size_t, CommandRecord>;
@@ -66,17 +202,21 @@ namespace detail
 
 struct Storage
 {
+    // records of this build, others are in db
     ConcurrentCommandStorage storage;
-    std::unique_ptr<FileHolder> commands;
+    std::unique_ptr<CommandDb> db;
+    FileIndex files;
 
-    Files file_storage;
-    mutable boost::upgrade_mutex m_file_storage_by_hash;
-    std::unordered_map<size_t, path> file_storage_by_hash;
-    std::unique_ptr<FileHolder> files;
+    // shared with scheduled flushes
+    std::shared_ptr<CommandLog> log;
+    std::once_flag log_created;
+
+    // loaded on the first use, only content hash checking needs it
+    FileHashCache hashes;
+    std::once_flag hashes_loaded;
 
     void closeLogs();
-    FileHolder &getCommandLog(const SwBuilderContext &swctx, const path &root);
-    FileHolder &getFileLog(const SwBuilderContext &swctx, const path &root);
+    const std::shared_ptr<CommandLog> &getLog(const SwBuilderContext &swctx, const path &root);
 };
 
 }
@@ -84,11 +224,15 @@ struct Storage
 struct FileDb
 {
     const SwBuilderContext &swctx;
+    // log is merged into db when it is larger
+    uint64_t log_merge_size;
 
     FileDb(const SwBuilderContext &swctx);
 
-    void load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, const path &root) const;
-    void save(const Files &files, const detail::Storage &, ConcurrentCommandStorage &commands, const path &root) const;
+    /// returns true if loaded records are not in db yet
+    bool load(detail::Storage &, const path &root) const;
+    /// must be called under the storage lock
+    void save(detail::Storage &, const path &root) const;
 
     static void write(std::vector<uint8_t> &, const CommandRecord &, const detail::Storage &);
 };
@@ -105,15 +249,17 @@ struct SW_BUILDER_API CommandStorage
 
     ConcurrentCommandStorage &getStorage();
     detail::Storage &getInternalStorage();
-    void async_command_log(const CommandRecord &r);
-    void add_user();
-    void free_user();
+    void async_command_log(CommandRecord &r);
+    /// inserted is true when the record is not in this build and not in db
     std::pair<CommandRecord *, bool> insert(size_t hash);
+    /// loads record from db on the first access, nullptr when it is missing
+    CommandRecord *find(size_t hash);
+    /// content hash of file at its current mtime, zero for missing files
+    Hash128 getContentHash(File &);
 
 private:
     FileDb fdb;
     detail::Storage s;
-    std::atomic_int n_users{ 0 };
     std::mutex m;
     std::unique_ptr<ScopedFileLock> lock;
     bool saved = false;
@@ -133,6 +133,14 @@ struct ConcurrentMap
         return *insert(k).first;
     }
 
+    // does not insert anything, returns nullptr when key is missing
+    V *find(K k) const
+    {
+        if (k == 0)
+            return nullptr;
+        return map->get(k);
+    }
+
     auto getIterator()
     {
         return typename MapType::Iterator(*map);
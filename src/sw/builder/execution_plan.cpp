@@ -18,11 +18,15 @@
 
 #include "execution_plan.h"
 
+#include "ready_queue.h"
+
 #include <sw/support/exceptions.h>
 
 #include <nlohmann/json.hpp>
 #include <primitives/exceptions.h>
 
+#include <numeric>
+
 namespace sw
 {
 
@@ -57,18 +61,58 @@ void ExecutionPlan::stop(bool interrupt_running_commands)
 }
 
 void ExecutionPlan::execute(Executor &e) const
+{
+    GenericCommandExecutor ge(e);
+    execute(ge);
+}
+
+// stat pass over all files of the plan on all threads,
+// files are refreshed once, so outdated checks are memory lookups after it
+static void refreshFiles(const ExecutionPlan::VecT &commands, CommandExecutor &e)
+{
+    // small chunks, commands have very different number of files
+    static constexpr size_t chunk = 16;
+
+    std::atomic_size_t next = 0;
+    size_t left = std::min(e.numberOfThreads(), (commands.size() + chunk - 1) / chunk);
+    std::mutex m;
+    std::condition_variable cv;
+    for (size_t t = 0, n = left; t < n; t++)
+    {
+        e.push([&commands, &next, &left, &m, &cv]
+        {
+            for (size_t i; (i = next.fetch_add(chunk)) < commands.size();)
+            {
+                for (auto j = i; j < std::min(i + chunk, commands.size()); j++)
+                {
+                    try
+                    {
+                        static_cast<builder::Command *>(commands[j])->refreshFiles();
+                    }
+                    catch (std::exception &)
+                    {
+                        // outdated check will report the error
+                    }
+                }
+            }
+            std::unique_lock lk(m);
+            if (--left == 0)
+                cv.notify_one();
+        });
+    }
+    std::unique_lock lk(m);
+    cv.wait(lk, [&left] { return left == 0; });
+}
+
+void ExecutionPlan::execute(CommandExecutor &e) const
 {
     if (!isValid())
         throw SW_RUNTIME_ERROR("Invalid execution plan");
     if (commands.empty())
         return;
 
-    std::mutex m;
-    std::vector<Future<void>> fs;
-    std::vector<Future<void>> all;
     std::atomic_bool stopped = false;
     interrupted = false;
-    std::atomic_int running = 0;
     std::atomic_int64_t askip_errors = skip_errors;
 
     bool build_commands = dynamic_cast<builder::Command *>(*commands.begin());
@@ -90,37 +134,156 @@ void ExecutionPlan::execute(Executor &e) const
         //c->markForExecution();
     }
 
-    std::function<void(PtrT)> run;
-    run = [this, &askip_errors, &e, &run, &fs, &all, &m, &running, &stopped](T *c)
+    if (build_commands && !build_always)
+        refreshFiles(commands, e);
+
+    // commands are referred by their indices in 'commands'
+    const uint32_t n = commands.size();
+    static constexpr uint32_t none = -1;
+
+    // rank 0 is executed first
+    std::vector<uint32_t> by_rank(n);
+    std::iota(by_rank.begin(), by_rank.end(), 0);
+    if (critical_path_scheduling)
+    {
+        setCriticalPathCosts();
+        std::stable_sort(by_rank.begin(), by_rank.end(), [this](auto i1, auto i2)
+        {
+            return commands[i1]->critical_path_cost > commands[i2]->critical_path_cost;
+        });
+    }
+    std::vector<uint32_t> ranks(n);
+    for (uint32_t r = 0; r < n; r++)
+        ranks[by_rank[r]] = r;
+
+    auto dependencies_left = std::make_unique<std::atomic_uint32_t[]>(n);
+    for (uint32_t i = 0; i < n; i++)
+        dependencies_left[i] = dependencies.degree(i);
+
+    // resources are requested once, they may use command storage
+    std::vector<CommandResources> resources;
+    resources.reserve(n);
+    for (auto &c : commands)
+        resources.push_back(c->getResources());
+
+    std::unique_ptr<AdmissionControl> own_admission;
+    auto admission = this->admission;
+    if (!admission)
+    {
+        auto b = budget;
+        if (!b.cpu)
+            b.cpu = e.numberOfThreads();
+        if (!b.memory)
+            b.memory = getPhysicalMemorySize();
+        own_admission = std::make_unique<AdmissionControl>(b);
+        admission = own_admission.get();
+    }
+
+    ReadyQueue ready(n);
+    std::atomic_size_t pending = 0; // pushed, but not finished tasks
+    std::atomic_size_t n_executed = 0;
+    std::mutex m;
+    std::condition_variable cv;
+    bool done = false; // guarded by m
+    std::vector<std::exception_ptr> eptrs;
+
+    // returns newly ready dependent to be executed on the same thread
+    std::function<uint32_t(uint32_t, bool)> run;
+
+    std::function<void(void)> task;
+
+    // parked command keeps its pending task
+    AdmissionControl::Retry retry = [&e, &ready, &task](size_t r)
     {
-        if (stopped || interrupted)
+        ready.push(r);
+        e.push([&task] { task(); });
+    };
+
+    // returns false if command was parked by admission control
+    auto execute_chain = [this, &ranks, &resources, admission, &run, &retry, &stopped](uint32_t i)
+    {
+        while (i != none)
+        {
+            bool remote;
+            if (!admission->acquireOrPark(resources[i], ranks[i], retry, remote))
+                return false;
+            auto next = run(i, remote);
+            admission->release(resources[i], remote, stopped || interrupted);
+            i = next;
+        }
+        return true;
+    };
+
+    // task takes the best ready command at the moment it starts
+    task = [&ready, &by_rank, &execute_chain, &pending, &m, &cv, &done]()
+    {
+        size_t r;
+        // item is always present, but we may miss it during concurrent pop
+        while (!ready.pop(r))
+            std::this_thread::yield();
+        if (!execute_chain(by_rank[r]))
             return;
+        if (--pending == 0)
+        {
+            // waiter leaves only after we release the lock,
+            // so do not touch anything after it
+            std::unique_lock lk(m);
+            done = true;
+            cv.notify_all();
+        }
+    };
+
+    auto push = [&e, &ready, &ranks, &pending, &task](uint32_t i)
+    {
+        ready.push(ranks[i]);
+        pending++;
+        e.push([&task] { task(); });
+    };
+
+    run = [this, build_commands, &askip_errors, &push, &ranks, &dependencies_left, &stopped, &n_executed, &m, &eptrs](uint32_t i, bool remote)
+    {
+        if (stopped || interrupted)
+            return none;
         try
         {
-            running++;
-            c->execute();
-            running--;
+            if (build_commands)
+                static_cast<builder::Command*>(commands[i])->run_remotely = remote;
+            commands[i]->execute();
         }
         catch (...)
         {
-            running--;
             if (--askip_errors < 1)
                 stopped = true;
-            if (throw_on_errors)
-                throw; // don't go futher on DAG by default
-        }
-        for (auto &d : c->dependent_commands)
-        {
-            if (--d->dependencies_left == 0)
             {
-                std::unique_lock<std::mutex> lk(m);
-                fs.push_back(e.push([&run, d] {run((T *)d.get()); }));
-                all.push_back(fs.back());
+                std::unique_lock lk(m);
+                eptrs.push_back(std::current_exception());
             }
+            if (throw_on_errors)
+                return none; // don't go futher on DAG by default
         }
+        n_executed++;
 
         if (stop_time && Clock::now() > *stop_time)
             stopped = true;
+
+        // keep the best newly ready dependent on this thread,
+        // its inputs are our outputs and it avoids the queue hop
+        auto next = none;
+        for (auto d = dependents.begin(i); d != dependents.end(i); d++)
+        {
+            if (--dependencies_left[*d] != 0)
+                continue;
+            if (next == none)
+                next = *d;
+            else if (ranks[*d] < ranks[next])
+            {
+                push(next);
+                next = *d;
+            }
+            else
+                push(*d);
+        }
+        return next;
     };
 
     // we cannot know exact number of commands to be executed,
@@ -132,61 +295,68 @@ void ExecutionPlan::execute(Executor &e) const
     // total_commands -= non outdated;
 
     // run commands without deps
+    // keep one extra pending task, so we are not signalled too early
+    pending++;
+    for (uint32_t i = 0; i < n; i++)
     {
-        std::unique_lock<std::mutex> lk(m);
-        for (auto &c : commands)
-        {
-            if (!c->dependencies.empty())
-                //continue;
-                break;
-            fs.push_back(e.push([&run, c] {run(c); }));
-            all.push_back(fs.back());
-        }
+        if (!dependencies.degree(i))
+            push(i);
     }
 
     // wait for all commands until exception
-    int i = 0;
-    auto sz = commands.size();
-    std::vector<std::exception_ptr> eptrs;
-    while (i != sz)
-    {
-        std::vector<Future<void>> fs2;
-        {
-            std::unique_lock<std::mutex> lk(m);
-            fs2 = fs;
-            fs.clear();
-        }
-        for (auto &f : fs2)
-        {
-            i++;
-            f.wait();
-        }
-        if (stopped || fs2.empty() || interrupted)
-            break;
-    }
-
-    // wait other jobs to finish or it will crash
-    while (running)
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    // gather exceptions
-    for (auto &f : all)
     {
-        if (f.state->eptr)
-            eptrs.push_back(f.state->eptr);
+        std::unique_lock lk(m);
+        if (--pending == 0)
+            done = true;
+        cv.wait(lk, [&done] { return done; });
     }
 
     // ... or it will crash here in throw
     if (!eptrs.empty() && throw_on_errors)
         throw ExceptionVector(eptrs);
 
-    if (i != sz)
+    auto sz = commands.size();
+    if (n_executed != sz)
     {
         if (stop_time && Clock::now() > *stop_time && stopped)
             throw SW_RUNTIME_ERROR("Time limit exceeded");
         if (interrupted)
             throw SW_RUNTIME_ERROR("Interrupted");
-        throw SW_RUNTIME_ERROR("Executor did not perform all steps (" + std::to_string(i) + "/" + std::to_string(sz) + ")");
+        throw SW_RUNTIME_ERROR("Executor did not perform all steps (" + std::to_string(n_executed) + "/" + std::to_string(sz) + ")");
+    }
+}
+
+void ExecutionPlan::setCriticalPathCosts() const
+{
+    // commands without history get average known cost,
+    // so we still prefer longer chains
+    uint64_t known_cost = 0;
+    size_t n_known = 0;
+    for (auto &c : commands)
+    {
+        c->critical_path_cost = c->getExecutionCost();
+        if (c->critical_path_cost)
+        {
+            known_cost += c->critical_path_cost;
+            n_known++;
+        }
+    }
+    const uint64_t default_cost = n_known ? std::max<uint64_t>(known_cost / n_known, 1) : 1;
+    for (auto &c : commands)
+    {
+        if (!c->critical_path_cost)
+            c->critical_path_cost = default_cost;
+    }
+
+    // dependents go before their dependencies
+    auto order = getTopologicalOrder(dependencies);
+    for (auto i = order.rbegin(); i != order.rend(); ++i)
+    {
+        // here critical_path_cost holds own cost
+        uint64_t max_dependent = 0;
+        for (auto d = dependents.begin(*i); d != dependents.end(*i); d++)
+            max_dependent = std::max(max_dependent, commands[*d]->critical_path_cost);
+        commands[*i]->critical_path_cost += max_dependent;
     }
 }
 
@@ -244,7 +414,18 @@ bool ExecutionPlan::isValid() const
 
 ExecutionPlan::Graph ExecutionPlan::getGraph() const
 {
-    return getGraph(commands);
+    // edge sets are released only in valid (frozen) plans
+    if (!isValid())
+        return getGraph(commands);
+
+    Graph g(commands.size());
+    for (uint32_t i = 0; i < commands.size(); i++)
+    {
+        g.m_vertices[i].m_property = commands[i];
+        for (auto d = dependencies.begin(i); d != dependencies.end(i); d++)
+            boost::add_edge(i, *d, g);
+    }
+    return g;
 }
 
 ExecutionPlan::Graph ExecutionPlan::getGraphUnprocessed() const
@@ -299,6 +480,19 @@ ExecutionPlan::Graph ExecutionPlan::getGraphSkeleton()
     return getGraphSkeleton(getGraph());
 }
 
+std::vector<ExecutionPlan::VecT> ExecutionPlan::getCycles() const
+{
+    std::vector<VecT> cycles;
+    for (auto &c : sw::getCycles(getIndexGraph(unprocessed_commands)))
+    {
+        VecT v;
+        for (auto i : c)
+            v.push_back(unprocessed_commands[i]);
+        cycles.push_back(std::move(v));
+    }
+    return cycles;
+}
+
 std::tuple<ExecutionPlan::Graph, size_t, ExecutionPlan::StrongComponents> ExecutionPlan::getStrongComponents()
 {
     auto g = getGraphUnprocessed();
@@ -365,35 +559,10 @@ ExecutionPlan::Graph ExecutionPlan::getGraph(const VecT &v, GraphMapping &gm)
 
 void ExecutionPlan::transitiveReduction()
 {
-    auto gm = getGraphMapping(commands);
-    auto g = getGraph(commands, gm);
-
-    auto[tr, vm] = transitiveReduction(g);
-
-    // copy props
-    for (auto &[from, to] : vm)
-        tr.m_vertices[to].m_property = g.m_vertices[from].m_property;
-
-    // make new edges (dependencies)
-    for (auto &[from, to] : vm)
-    {
-        auto c = commands[from];
-        c->dependencies.clear();
-        for (auto &e : tr.m_vertices[to].m_out_edges)
-            c->dependencies.insert(tr.m_vertices[e.m_target].m_property->shared_from_this());
-    }
-}
-
-std::tuple<ExecutionPlan::Graph, ExecutionPlan::VertexMap> ExecutionPlan::transitiveReduction(const Graph &g)
-{
-    Graph tr;
-    VertexMap vm;
-
-    std::vector<size_t> id_map(boost::num_vertices(g));
-    std::iota(id_map.begin(), id_map.end(), 0u);
-
-    boost::transitive_reduction(g, tr, boost::make_assoc_property_map(vm), id_map.data());
-    return { tr, vm };
+    if (!isValid())
+        return;
+    dependencies = getTransitiveReduction(dependencies);
+    dependents = dependencies.reversed();
 }
 
 void ExecutionPlan::prepare(USet &cmds)
@@ -471,8 +640,12 @@ void ExecutionPlan::prepare(USet &cmds)
                 return i->second->shared_from_this();
         };
 
-        auto replace2 = [&replace](auto &a)
+        auto replace2 = [&replace, &cmds3](auto &a)
         {
+            // most sets have no duplicates, do not copy them
+            if (std::all_of(a.begin(), a.end(), [&cmds3](const auto &d)
+                { return cmds3.find(d->getHash())->second == d.get(); }))
+                return;
             auto copy = a;
             a.clear();
             for (auto &d : copy)
@@ -491,55 +664,72 @@ void ExecutionPlan::prepare(USet &cmds)
     }
 }
 
-void ExecutionPlan::init(USet &cmds)
+IndexGraph ExecutionPlan::getIndexGraph(const VecT &v)
 {
-    while (!cmds.empty())
+    std::unordered_map<PtrT, uint32_t> ids;
+    ids.reserve(v.size());
+    for (auto &c : v)
+        ids.emplace(c, (uint32_t)ids.size());
+
+    IndexGraph g;
+    g.offsets.reserve(v.size() + 1);
+    for (auto &c : v)
     {
-        bool added = false;
-        for (auto it = cmds.begin(); it != cmds.end();)
+        g.addNode();
+        // deps outside of the set are ignored
+        for (auto &d : c->dependencies)
         {
-            // count number of deps
-            auto n = std::count_if((*it)->dependencies.begin(), (*it)->dependencies.end(),
-                [this, &cmds](auto &d) { return cmds.find(d.get()) != cmds.end(); });
-            if (n)
-            {
-                it++;
-                continue;
-            }
-            added = true;
-            commands.push_back(*it);
-            it = cmds.erase(it);
+            auto i = ids.find(d.get());
+            if (i != ids.end())
+                g.addEdge(i->second);
         }
-        if (!added)
+    }
+    return g;
+}
+
+void ExecutionPlan::init(USet &cmds)
+{
+    VecT v(cmds.begin(), cmds.end());
+    auto order = getTopologicalOrder(getIndexGraph(v));
+    commands.reserve(order.size());
+    for (auto i : order)
+        commands.push_back(v[i]);
+    if (order.size() != v.size())
+    {
+        // cycles and commands depending on them
+        std::vector<bool> processed(v.size());
+        for (auto i : order)
+            processed[i] = true;
+        for (size_t i = 0; i < v.size(); i++)
         {
-            // We failed with stupid algorithm, now we must perform smarter.
-            // Shall we?
-            unprocessed_commands.insert(unprocessed_commands.end(), cmds.begin(), cmds.end());
-            unprocessed_commands_set = cmds;
-            return;
+            if (!processed[i])
+                unprocessed_commands.push_back(v[i]);
         }
+        unprocessed_commands_set.insert(unprocessed_commands.begin(), unprocessed_commands.end());
+        return;
     }
 
     // setup
 
-    // potentially *should* speedup later execution
-    // TODO: measure and decide
-    // it reduses some memory usage,
-    // but influence on performance on execution stages is not very clear
-    //transitiveReduction();
-
-    // set number of deps and dependent commands
-    for (auto &c : commands)
-    {
-        c->dependencies_left = c->dependencies.size();
-        for (auto &d : c->dependencies)
-            d->dependent_commands.insert(c->shared_from_this());
-    }
-
     std::sort(commands.begin(), commands.end(), [](const auto &c1, const auto &c2)
     {
         return c1->lessDuringExecution(*c2);
     });
+
+    freeze();
+}
+
+void ExecutionPlan::freeze()
+{
+    dependencies = getIndexGraph(commands);
+    dependents = dependencies.reversed();
+
+    // sets held the last references to some commands
+    command_refs.reserve(commands.size());
+    for (auto &c : commands)
+        command_refs.push_back(c->shared_from_this());
+    for (auto &c : commands)
+        c->clear();
 }
 
 void ExecutionPlan::setTimeLimit(const Clock::duration &d)
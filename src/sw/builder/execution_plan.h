@@ -18,13 +18,14 @@
 
 #pragma once
 
+#include "admission.h"
 #include "command.h"
+#include "command_executor.h"
+#include "command_graph.h"
 
-#include <iso646.h> // for #include <boost/graph/transitive_reduction.hpp>
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/strong_components.hpp>
-#include <boost/graph/transitive_reduction.hpp>
 #include <boost/graph/graph_utility.hpp> // dumping graphs
 #include <boost/graph/graphviz.hpp>      // generating pictures
 
@@ -62,6 +63,14 @@ public:
     bool silent = false;
     bool show_output = false;
     bool write_output_to_file = false;
+    // dispatch ready command with the longest remaining path first,
+    // otherwise use static order (lessDuringExecution())
+    bool critical_path_scheduling = true;
+    // commands are started only when they fit into the budget
+    // cpu defaults to number of executor threads, memory - to physical memory size
+    ResourceBudget budget;
+    // shared by plans running on the same executor, budget is not used when set
+    AdmissionControl *admission = nullptr;
 
     ExecutionPlan(USet &cmds);
     ExecutionPlan(const ExecutionPlan &rhs) = delete;
@@ -69,6 +78,7 @@ public:
     ~ExecutionPlan();
 
     //
+    void execute(CommandExecutor &e) const;
     void execute(Executor &e) const;
 
     // external request to stop execution
@@ -80,6 +90,14 @@ public:
     static Commands load(const path &, const SwBuilderContext &, int type = 0);
     void save(const path &, int type = 0) const;
 
+    /// compact prepared plan: command order, hashes and edges
+    void saveSnapshot(const path &, const String &key) const;
+    /// returns true if snapshot exists and has the same key
+    static bool hasSnapshot(const path &, const String &key);
+    /// builds plan from commands loaded with load() skipping preparation,
+    /// returns nullptr if snapshot does not match commands
+    static std::unique_ptr<ExecutionPlan> loadSnapshot(const path &, const String &key, const Commands &);
+
     void saveChromeTrace(const path &) const;
     void setTimeLimit(const Clock::duration &);
 
@@ -88,6 +106,11 @@ public:
     const USet &getUnprocessedCommandsSet() const { return unprocessed_commands_set; }
 
     bool isValid() const;
+    size_t getNumberOfEdges() const { return dependencies.edges.size(); }
+
+    /// removes dependencies implied by other dependencies,
+    /// must be called before execution
+    void transitiveReduction();
 
     Graph getGraph() const;
     Graph getGraphUnprocessed() const;
@@ -97,6 +120,10 @@ public:
     static Graph getGraphSkeleton(const Graph &in);
     Graph getGraphSkeleton();
     std::tuple<Graph, size_t, StrongComponents> getStrongComponents();
+    /// dependency cycles among unprocessed commands
+    std::vector<VecT> getCycles() const;
+    /// dependencies inside 'v', nodes are indices in 'v'
+    static IndexGraph getIndexGraph(const VecT &v);
     void printGraph(path p) const;
 
     template <class G>
@@ -115,23 +142,27 @@ public:
     }
 
 private:
-    using Vertex = typename boost::graph_traits<Graph>::vertex_descriptor;
-    using VertexMap = std::unordered_map<Vertex, Vertex>;
-
     VecT commands;
+    // frozen graph, nodes are indices in 'commands'
+    IndexGraph dependencies;
+    IndexGraph dependents;
+    // owns commands after their edge sets are released
+    Vec<std::shared_ptr<T>> command_refs;
     VecT unprocessed_commands;
     USet unprocessed_commands_set;
-    mutable std::atomic_bool interrupted;
+    mutable std::atomic_bool interrupted = false;
 
     //
     std::optional<Clock::time_point> stop_time;
 
+    ExecutionPlan() = default;
+
     static GraphMapping getGraphMapping(const VecT &v);
     static Graph getGraph(const VecT &v, GraphMapping &gm);
-    void transitiveReduction();
-    static std::tuple<Graph, VertexMap> transitiveReduction(const Graph &g);
     static void prepare(USet &cmds);
     void init(USet &cmds);
+    void freeze();
+    void setCriticalPathCosts() const;
 };
 
 extern template SW_BUILDER_API void ExecutionPlan::printGraph(const ExecutionPlan::Graph &, const path &base, const ExecutionPlan::VecT &, bool);
@@ -86,7 +86,8 @@ Commands ExecutionPlan::load(const path &p, const SwBuilderContext &swctx, int t
     for (auto &c : commands)
     {
         c->setContext(swctx);
-        c->command_storage = &swctx.getCommandStorage(c->command_storage_root);
+        if (!c->command_storage_root.empty())
+            c->command_storage = &swctx.getCommandStorage(c->command_storage_root);
     }
     return commands;
 }
@@ -122,4 +123,138 @@ void ExecutionPlan::save(const path &p, int type) const
     }
 }
 
+namespace
+{
+
+// commands are not serialized with their dependencies,
+// so edges between saved commands go separately as indices
+template <class Ar>
+void save_command_sets(Ar &ar, const std::vector<Commands> &sets)
+{
+    std::vector<std::shared_ptr<builder::Command>> commands;
+    std::unordered_map<const CommandNode *, uint32_t> ids;
+    std::vector<std::vector<uint32_t>> set_ids;
+    for (auto &s : sets)
+    {
+        auto &v = set_ids.emplace_back();
+        for (auto &c : s)
+        {
+            auto i = ids.emplace(c.get(), (uint32_t)commands.size());
+            if (i.second)
+                commands.push_back(c);
+            v.push_back(i.first->second);
+        }
+    }
+
+    std::vector<std::vector<uint32_t>> edges(commands.size());
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        for (auto &d : commands[i]->dependencies)
+        {
+            auto j = ids.find(d.get());
+            if (j != ids.end())
+                edges[i].push_back(j->second);
+        }
+    }
+
+    ar << commands;
+    ar << set_ids;
+    ar << edges;
+}
+
+template <class Ar>
+std::vector<Commands> load_command_sets(Ar &ar)
+{
+    std::vector<std::shared_ptr<builder::Command>> commands;
+    std::vector<std::vector<uint32_t>> set_ids;
+    std::vector<std::vector<uint32_t>> edges;
+    ar >> commands;
+    ar >> set_ids;
+    ar >> edges;
+    if (edges.size() != commands.size())
+        throw SW_RUNTIME_ERROR("Bad commands archive");
+
+    auto get = [&commands](uint32_t i)
+    {
+        if (i >= commands.size())
+            throw SW_RUNTIME_ERROR("Bad commands archive");
+        return commands[i];
+    };
+
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        for (auto j : edges[i])
+            commands[i]->dependencies.insert(get(j));
+    }
+
+    std::vector<Commands> sets;
+    for (auto &v : set_ids)
+    {
+        auto &s = sets.emplace_back();
+        for (auto i : v)
+            s.insert(get(i));
+    }
+    return sets;
+}
+
+}
+
+std::vector<Commands> loadCommandSets(const path &p, int type)
+{
+    if (type == 0)
+    {
+        std::ifstream ifs(p, std::ios_base::in | std::ios_base::binary);
+        if (!ifs)
+            throw SW_RUNTIME_ERROR("Cannot read file: " + normalize_path(p));
+        boost::archive::binary_iarchive ar(ifs);
+        setup_ar(ar);
+        return load_command_sets(ar);
+    }
+    else if (type == 1)
+    {
+        std::ifstream ifs(p);
+        if (!ifs)
+            throw SW_RUNTIME_ERROR("Cannot read file: " + normalize_path(p));
+        boost::archive::text_iarchive ar(ifs);
+        setup_ar(ar);
+        return load_command_sets(ar);
+    }
+    return {};
+}
+
+void saveCommandSets(const path &p, const std::vector<Commands> &sets, int type)
+{
+    fs::create_directories(p.parent_path());
+
+    if (type == 0)
+    {
+        std::ofstream ofs(p, std::ios_base::out | std::ios_base::binary);
+        if (!ofs)
+            throw SW_RUNTIME_ERROR("Cannot write file: " + normalize_path(p));
+        boost::archive::binary_oarchive ar(ofs);
+        setup_ar(ar);
+        save_command_sets(ar, sets);
+    }
+    else if (type == 1)
+    {
+        std::ofstream ofs(p);
+        if (!ofs)
+            throw SW_RUNTIME_ERROR("Cannot write file: " + normalize_path(p));
+        boost::archive::text_oarchive ar(ofs);
+        setup_ar(ar);
+        save_command_sets(ar, sets);
+    }
+}
+
+Commands loadCommands(const path &p, int type)
+{
+    auto sets = loadCommandSets(p, type);
+    return sets.empty() ? Commands{} : sets[0];
+}
+
+void saveCommands(const path &p, const Commands &commands, int type)
+{
+    saveCommandSets(p, { commands }, type);
+}
+
 }
@@ -0,0 +1,219 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "execution_plan.h"
+
+#include <sw/support/exceptions.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <primitives/exceptions.h>
+
+// snapshot layout, native endianness:
+//
+//  u32 magic, u32 version
+//  u32 key size, key
+//  u64 n commands, u64 n edges
+//  u64 hashes[n]            in plan order
+//  u64 offsets[n + 1]       into deps
+//  u32 deps[n edges]        indices of dependencies
+
+#define EXECUTION_PLAN_SNAPSHOT_MAGIC 0x50455753 // SWEP
+#define EXECUTION_PLAN_SNAPSHOT_VERSION 1
+
+namespace sw
+{
+
+namespace
+{
+
+struct SnapshotReader
+{
+    const uint8_t *p;
+    const uint8_t *end;
+
+    template <class T>
+    bool read(T &v)
+    {
+        if (p + sizeof(T) > end)
+            return false;
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    // returns pointer to n values, data may be unaligned
+    const uint8_t *skip(size_t n)
+    {
+        if (n > (size_t)(end - p))
+            return nullptr;
+        auto r = p;
+        p += n;
+        return r;
+    }
+
+    bool readHeader(const String &key)
+    {
+        uint32_t v;
+        if (!read(v) || v != EXECUTION_PLAN_SNAPSHOT_MAGIC)
+            return false;
+        if (!read(v) || v != EXECUTION_PLAN_SNAPSHOT_VERSION)
+            return false;
+        if (!read(v) || v != key.size())
+            return false;
+        auto k = skip(v);
+        return k && memcmp(k, key.data(), v) == 0;
+    }
+};
+
+struct MappedSnapshot
+{
+    boost::interprocess::file_mapping fm;
+    boost::interprocess::mapped_region r;
+
+    MappedSnapshot(const path &p)
+        : fm(p.string().c_str(), boost::interprocess::read_only)
+        , r(fm, boost::interprocess::read_only)
+    {
+    }
+
+    SnapshotReader getReader() const
+    {
+        auto b = (const uint8_t *)r.get_address();
+        return { b, b + r.get_size() };
+    }
+};
+
+}
+
+template <class T>
+static void write_int(String &s, T v)
+{
+    s.append((const char *)&v, sizeof(v));
+}
+
+void ExecutionPlan::saveSnapshot(const path &p, const String &key) const
+{
+    if (!isValid())
+        throw SW_RUNTIME_ERROR("Invalid execution plan");
+
+    String hashes, offsets, deps;
+    for (auto &c : commands)
+        write_int<uint64_t>(hashes, c->getHash());
+    for (auto o : dependencies.offsets)
+        write_int<uint64_t>(offsets, o);
+    for (auto d : dependencies.edges)
+        write_int(deps, d);
+    uint64_t n_edges = dependencies.edges.size();
+
+    String s;
+    write_int<uint32_t>(s, EXECUTION_PLAN_SNAPSHOT_MAGIC);
+    write_int<uint32_t>(s, EXECUTION_PLAN_SNAPSHOT_VERSION);
+    write_int<uint32_t>(s, key.size());
+    s += key;
+    write_int<uint64_t>(s, commands.size());
+    write_int(s, n_edges);
+    s += hashes;
+    s += offsets;
+    s += deps;
+
+    // write to temp file first, so partially written snapshot is never used
+    fs::create_directories(p.parent_path());
+    auto tmp = path(p) += ".tmp";
+    write_file(tmp, s);
+    fs::rename(tmp, p);
+}
+
+bool ExecutionPlan::hasSnapshot(const path &p, const String &key)
+{
+    if (!fs::exists(p) || fs::file_size(p) == 0)
+        return false;
+    MappedSnapshot m(p);
+    return m.getReader().readHeader(key);
+}
+
+std::unique_ptr<ExecutionPlan> ExecutionPlan::loadSnapshot(const path &p, const String &key, const Commands &in)
+{
+    if (!hasSnapshot(p, key))
+        return {};
+
+    MappedSnapshot m(p);
+    auto r = m.getReader();
+    r.readHeader(key);
+    uint64_t n, n_edges;
+    if (!r.read(n) || !r.read(n_edges) || n != in.size())
+        return {};
+    auto hashes = r.skip(n * sizeof(uint64_t));
+    auto offsets = r.skip((n + 1) * sizeof(uint64_t));
+    auto deps = r.skip(n_edges * sizeof(uint32_t));
+    if (!hashes || !offsets || !deps)
+        return {};
+    auto get = [](const uint8_t *a, size_t i, auto v)
+    {
+        memcpy(&v, a + i * sizeof(v), sizeof(v));
+        return v;
+    };
+
+    // commands were not prepared yet, hashes are calculated there
+    std::unordered_map<size_t, PtrT> by_hash;
+    by_hash.reserve(in.size());
+    for (auto &c : in)
+    {
+        c->prepare();
+        by_hash[c->getHash()] = c.get();
+    }
+
+    std::unique_ptr<ExecutionPlan> ep(new ExecutionPlan);
+    ep->commands.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto h = by_hash.find(get(hashes, i, uint64_t{}));
+        if (h == by_hash.end())
+            return {};
+        ep->commands.push_back(h->second);
+    }
+
+    // edges go directly into the compact graph
+    auto &g = ep->dependencies;
+    g.offsets.resize(n + 1);
+    for (size_t i = 0; i <= n; i++)
+    {
+        g.offsets[i] = get(offsets, i, uint64_t{});
+        if (g.offsets[i] > n_edges || (i && g.offsets[i] < g.offsets[i - 1]))
+            return {};
+    }
+    if (g.offsets[0] != 0 || g.offsets[n] != n_edges)
+        return {};
+    g.edges.resize(n_edges);
+    for (size_t j = 0; j < n_edges; j++)
+    {
+        g.edges[j] = get(deps, j, uint32_t{});
+        if (g.edges[j] >= n)
+            return {};
+    }
+    ep->dependents = g.reversed();
+
+    // edges found during prepare() are not needed
+    for (auto &c : ep->commands)
+        ep->command_refs.push_back(c->shared_from_this());
+    for (auto &c : ep->commands)
+        c->clear();
+    return ep;
+}
+
+}
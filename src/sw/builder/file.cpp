@@ -28,6 +28,13 @@
 #include <fstream>
 #include <sstream>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "file");
 
@@ -75,6 +82,9 @@ FileData &FileData::operator=(const FileData &rhs)
     //size = rhs.size;
     //hash = rhs.hash;
     //flags = rhs.flags;
+    same_content_since = rhs.same_content_since;
+    content_hash = rhs.content_hash;
+    content_hash_time = rhs.content_hash_time;
 
     refreshed = rhs.refreshed.load();
 
@@ -100,6 +110,14 @@ File::File(const path &p, FileStorage &fs)
     data = &fs.registerFile(file);
 }
 
+File::File(FileId id, FileStorage &fs)
+    : file(getPathInterner().getPath(id))
+{
+    if (!id)
+        throw SW_RUNTIME_ERROR("Empty file");
+    data = &fs.registerFile(id);
+}
+
 path File::getPath() const
 {
     return file;
@@ -115,6 +133,97 @@ const FileData &File::getFileData() const
     return *data;
 }
 
+#ifdef _WIN32
+using NativeFileTime = std::chrono::duration<int64_t, std::ratio<1, 10'000'000>>;
+#else
+using NativeFileTime = std::chrono::nanoseconds;
+#endif
+
+enum class NativeFileType
+{
+    NotFound,
+    Regular,
+    Other,
+    Unknown, // use std::filesystem
+};
+
+// type and mtime in one syscall, fs::status() + fs::last_write_time() take two
+static NativeFileType native_stat(const path &p, NativeFileTime &t)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA d;
+    if (!GetFileAttributesExW(p.wstring().c_str(), GetFileExInfoStandard, &d))
+        return NativeFileType::NotFound;
+    t = NativeFileTime(((int64_t)d.ftLastWriteTime.dwHighDateTime << 32) | d.ftLastWriteTime.dwLowDateTime);
+    // attributes are not followed
+    if (d.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+        return NativeFileType::Unknown;
+    if (d.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE))
+        return NativeFileType::Other;
+    return NativeFileType::Regular;
+#elif defined(__linux__) && defined(STATX_MTIME)
+    struct statx st;
+    if (statx(AT_FDCWD, p.c_str(), 0, STATX_TYPE | STATX_MTIME, &st) != 0)
+        return NativeFileType::NotFound;
+    t = std::chrono::seconds(st.stx_mtime.tv_sec) + std::chrono::nanoseconds(st.stx_mtime.tv_nsec);
+    return S_ISREG(st.stx_mode) ? NativeFileType::Regular : NativeFileType::Other;
+#else
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0)
+        return NativeFileType::NotFound;
+#ifdef __APPLE__
+    t = std::chrono::seconds(st.st_mtimespec.tv_sec) + std::chrono::nanoseconds(st.st_mtimespec.tv_nsec);
+#else
+    t = std::chrono::seconds(st.st_mtim.tv_sec) + std::chrono::nanoseconds(st.st_mtim.tv_nsec);
+#endif
+    return S_ISREG(st.st_mode) ? NativeFileType::Regular : NativeFileType::Other;
+#endif
+}
+
+// used when measuring fails, epochs are compared through the clocks
+static fs::file_time_type::duration getFileTimeEpochDifferenceFromClocks()
+{
+    using namespace std::chrono;
+    // file time epoch relative to the unix epoch
+    auto d = fs::file_time_type::clock::now().time_since_epoch() -
+        duration_cast<fs::file_time_type::duration>(system_clock::now().time_since_epoch());
+    // clocks are read one after another, epochs differ by whole seconds
+    auto ds = round<seconds>(d);
+#ifdef _WIN32
+    // native times start from 1601-01-01
+    ds -= seconds(11644473600LL);
+#endif
+    return ds;
+}
+
+// file_time_type has implementation defined epoch,
+// so the difference is measured once on the same file
+static fs::file_time_type::duration getFileTimeEpochDifference()
+{
+    static const auto d = []
+    {
+        auto p = fs::current_path();
+        for (int i = 0; i < 10; i++)
+        {
+            NativeFileTime t1, t2;
+            auto type1 = native_stat(p, t1);
+            if (type1 == NativeFileType::NotFound || type1 == NativeFileType::Unknown)
+                break;
+            std::error_code ec;
+            auto lwt = fs::last_write_time(p, ec);
+            if (ec)
+                break;
+            if (native_stat(p, t2) != type1)
+                continue;
+            if (t1 == t2) // not changed in between
+                return lwt.time_since_epoch() - std::chrono::duration_cast<fs::file_time_type::duration>(t1);
+        }
+        LOG_DEBUG(logger, "cannot measure file time epoch on " << p << ", using clocks");
+        return getFileTimeEpochDifferenceFromClocks();
+    }();
+    return d;
+}
+
 void FileData::refresh(const path &file)
 {
     FileData::RefreshType r = FileData::RefreshType::Unrefreshed;
@@ -122,10 +231,19 @@ void FileData::refresh(const path &file)
         return;
 
     bool changed = false;
-    auto s = fs::status(file);
-    if (s.type() != fs::file_type::regular)
+    NativeFileTime nt;
+    auto type = native_stat(file, nt);
+    if (type == NativeFileType::Unknown)
+    {
+        auto s = fs::status(file);
+        type = s.type() == fs::file_type::regular ? NativeFileType::Regular :
+            s.type() == fs::file_type::not_found ? NativeFileType::NotFound : NativeFileType::Other;
+        if (type == NativeFileType::Regular)
+            nt = std::chrono::duration_cast<NativeFileTime>(fs::last_write_time(file).time_since_epoch() - getFileTimeEpochDifference());
+    }
+    if (type != NativeFileType::Regular)
     {
-        if (s.type() != fs::file_type::not_found)
+        if (type != NativeFileType::NotFound)
             LOG_TRACE(logger, "checking for non-regular file: " << file);
         // we skip non regular files at the moment
         last_write_time = fs::file_time_type::min();
@@ -133,7 +251,7 @@ void FileData::refresh(const path &file)
     }
     else
     {
-        auto t = fs::last_write_time(file);
+        auto t = fs::file_time_type(std::chrono::duration_cast<fs::file_time_type::duration>(nt) + getFileTimeEpochDifference());
         if (t > last_write_time)
         {
             last_write_time = t;
@@ -19,6 +19,9 @@
 #pragma once
 
 #include "node.h"
+#include "path_interner.h"
+
+#include <sw/support/hash.h>
 
 #include <primitives/filesystem.h>
 
@@ -63,6 +66,15 @@ struct FileData
     std::atomic<RefreshType> refreshed{ RefreshType::Unrefreshed };
     //mutable std::mutex m;
 
+    // set when generator rewrote the file with the same content during this build,
+    // dependents built after this time are still up to date
+    fs::file_time_type same_content_since = fs::file_time_type::max();
+
+    // content hash for content_hash_time, see CommandStorage::getContentHash()
+    Hash128 content_hash;
+    fs::file_time_type content_hash_time = fs::file_time_type::min();
+    std::mutex content_hash_mutex;
+
     FileData() = default;
     FileData(const FileData &);
     FileData &operator=(const FileData &rhs);
@@ -77,6 +89,7 @@ struct SW_BUILDER_API File : virtual ICastable
 
     File() = default;
     File(const path &p, FileStorage &s);
+    File(FileId, FileStorage &s);
     virtual ~File() = default;
 
     path getPath() const;
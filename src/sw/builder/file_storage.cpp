@@ -40,11 +40,24 @@ void FileStorage::reset()
 
 FileData &FileStorage::registerFile(const path &in_f)
 {
-    auto p = normalize_path(in_f);
-    auto d = files.insert(p);
+    auto id = getPathInterner().intern(in_f);
+    // id 0 is reserved for empty path, map does not accept it
+    if (!id)
+        throw SW_RUNTIME_ERROR("Cannot register file with empty path");
+    auto d = files.insert(id);
     if (d.second)
         d.first->refresh(in_f);
     return *d.first;
 }
 
+FileData &FileStorage::registerFile(FileId id)
+{
+    if (!id)
+        throw SW_RUNTIME_ERROR("Cannot register file with empty path");
+    auto d = files.insert(id);
+    if (d.second)
+        d.first->refresh(getPathInterner().getPath(id));
+    return *d.first;
+}
+
 }
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "concurrent_map.h"
+#include "path_interner.h"
 
 #include <primitives/filesystem.h>
 
@@ -30,14 +31,17 @@ struct SwBuilderContext;
 
 struct SW_BUILDER_API FileStorage
 {
-    using FileDataHashMap = ConcurrentHashMap<path, FileData>;
+    // keys are file ids
+    using FileDataMap = ConcurrentMapSimple<FileData>;
 
-    FileDataHashMap files;
+    FileDataMap files;
 
     void clear(); // remove?
     void reset(); // remove?
 
+    // throw on empty path
     FileData &registerFile(const path &f);
+    FileData &registerFile(FileId);
 };
 
 }
@@ -0,0 +1,98 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "path_interner.h"
+
+#include <sw/support/hash.h>
+
+#include <primitives/exceptions.h>
+
+#include <mutex>
+
+namespace sw
+{
+
+SW_DEFINE_GLOBAL_STATIC_FUNCTION(PathInterner, getPathInterner)
+
+PathInterner::PathInterner()
+    : chunks(std::make_unique<std::atomic<Entry *>[]>(max_chunks))
+    , shards(std::make_unique<Shard[]>(n_shards))
+{
+    for (size_t i = 0; i < max_chunks; i++)
+        chunks[i] = nullptr;
+    allocate(0); // empty path
+}
+
+PathInterner::~PathInterner()
+{
+    for (size_t i = 0; i < max_chunks; i++)
+        delete[] chunks[i].load();
+}
+
+PathInterner::Entry &PathInterner::allocate(FileId id)
+{
+    auto i = id >> chunk_bits;
+    if (i >= max_chunks)
+        throw SW_RUNTIME_ERROR("Too many files");
+    auto c = chunks[i].load(std::memory_order_acquire);
+    if (!c)
+    {
+        auto n = new Entry[chunk_size];
+        if (chunks[i].compare_exchange_strong(c, n, std::memory_order_acq_rel))
+            c = n;
+        else
+            delete[] n; // other shard was first, c is loaded
+    }
+    return c[id & (chunk_size - 1)];
+}
+
+FileId PathInterner::intern(const path &p)
+{
+    if (p.empty())
+        return 0;
+    return internNormalized(normalize_path(p));
+}
+
+FileId PathInterner::internNormalized(const String &s)
+{
+    if (s.empty())
+        return 0;
+
+    auto h = hash64(s);
+    auto &shard = shards[h % n_shards];
+    {
+        std::shared_lock lk(shard.m);
+        auto i = shard.ids.find(s);
+        if (i != shard.ids.end())
+            return i->second;
+    }
+
+    std::unique_lock lk(shard.m);
+    auto i = shard.ids.find(s);
+    if (i != shard.ids.end())
+        return i->second;
+    auto id = next_id++;
+    auto &e = allocate(id);
+    e.s = s;
+    e.hash = h;
+    // key points into the entry, entries never move
+    shard.ids.emplace(e.s, id);
+    return id;
+}
+
+}
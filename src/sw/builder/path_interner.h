@@ -0,0 +1,88 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/filesystem.h>
+#include <primitives/templates.h>
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace sw
+{
+
+/// dense id of interned path, 0 is empty path
+using FileId = uint32_t;
+
+/// global table of normalized paths
+///
+/// Every path is stored once as normalized utf-8 string.
+/// Ids are never reused and lookups by id take no locks.
+struct SW_BUILDER_API PathInterner
+{
+    PathInterner();
+    PathInterner(const PathInterner &) = delete;
+    PathInterner &operator=(const PathInterner &) = delete;
+    ~PathInterner();
+
+    FileId intern(const path &);
+    /// string must be normalized already
+    FileId internNormalized(const String &);
+
+    const String &getString(FileId id) const { return get(id).s; }
+    path getPath(FileId id) const { return fs::u8path(getString(id)); }
+    /// hash64() of normalized string, it is stored in command db
+    uint64_t getHash(FileId id) const { return get(id).hash; }
+
+private:
+    struct Entry
+    {
+        String s;
+        uint64_t hash = 0;
+    };
+
+    struct Shard
+    {
+        std::shared_mutex m;
+        std::unordered_map<std::string_view, FileId> ids;
+    };
+
+    static constexpr size_t chunk_bits = 12;
+    static constexpr size_t chunk_size = 1 << chunk_bits;
+    static constexpr size_t max_chunks = 1 << 16;
+    static constexpr size_t n_shards = 64;
+
+    std::unique_ptr<std::atomic<Entry *>[]> chunks;
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<FileId> next_id{ 1 };
+
+    const Entry &get(FileId id) const
+    {
+        return chunks[id >> chunk_bits].load(std::memory_order_acquire)[id & (chunk_size - 1)];
+    }
+    Entry &allocate(FileId id);
+};
+
+SW_BUILDER_API
+SW_DECLARE_GLOBAL_STATIC_FUNCTION(PathInterner, getPathInterner);
+
+}
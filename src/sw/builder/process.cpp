@@ -0,0 +1,385 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "process.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace sw
+{
+
+namespace
+{
+
+struct ProcessExitCategory : std::error_category
+{
+    const char *name() const noexcept override { return "process"; }
+
+    std::string message(int code) const override
+    {
+        return "process exited with code " + std::to_string(code);
+    }
+};
+
+}
+
+static const std::error_category &process_exit_category()
+{
+    static ProcessExitCategory c;
+    return c;
+}
+
+std::error_code make_process_exit_error(int code)
+{
+    return std::error_code(code, process_exit_category());
+}
+
+#ifndef _WIN32
+
+namespace
+{
+
+struct Fd
+{
+    int fd = -1;
+
+    Fd() = default;
+    Fd(const Fd &) = delete;
+    ~Fd() { close(); }
+
+    void close()
+    {
+        if (fd != -1)
+            ::close(fd);
+        fd = -1;
+    }
+};
+
+}
+
+static bool make_pipe(Fd &r, Fd &w)
+{
+    int fds[2];
+#ifdef __linux__
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return false;
+#else
+    if (pipe(fds) == -1)
+        return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+    r.fd = fds[0];
+    w.fd = fds[1];
+    return true;
+}
+
+static uint64_t to_us(const timeval &tv)
+{
+    return (uint64_t)tv.tv_sec * 1'000'000 + tv.tv_usec;
+}
+
+SpawnArgs makeSpawnArgs(const primitives::Command &c)
+{
+    SpawnArgs s;
+    auto add = [&s](std::vector<uint32_t> &v, const String &a)
+    {
+        v.push_back((uint32_t)s.arena.size());
+        s.arena += a;
+        s.arena += '\0';
+    };
+
+    auto &args = c.getArguments();
+    if (args.empty() || !path(args[0]->toString()).is_absolute())
+        return {};
+    for (auto &a : args)
+        add(s.argv, a->toString());
+
+    // environment of the build process does not change during build
+    if (!c.environment.empty())
+    {
+        for (auto e = environ; *e; e++)
+        {
+            String v = *e;
+            if (c.environment.find(v.substr(0, v.find('='))) == c.environment.end())
+                add(s.envp, v);
+        }
+        for (auto &[k, v] : c.environment)
+            add(s.envp, k + "=" + v);
+    }
+    return s;
+}
+
+// posix_spawn() is cheaper than fork() for big parent processes,
+// but it can change directory only with a recent libc
+#if defined(__APPLE__) || (defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29)))
+#define SW_HAVE_POSIX_SPAWN_CHDIR
+#endif
+
+namespace
+{
+
+struct SpawnActions
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+
+    SpawnActions()
+    {
+        posix_spawn_file_actions_init(&fa);
+        posix_spawnattr_init(&attr);
+    }
+
+    ~SpawnActions()
+    {
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&fa);
+    }
+};
+
+}
+
+// returns errno
+static int spawn(pid_t &pid, char **argv, char **envp, const String &wd, int in, int out, int err)
+{
+    SpawnActions a;
+    int e = 0;
+#ifdef SW_HAVE_POSIX_SPAWN_CHDIR
+    if (!wd.empty() && (e = posix_spawn_file_actions_addchdir_np(&a.fa, wd.c_str())))
+        return e;
+#endif
+    if (in != -1 && (e = posix_spawn_file_actions_adddup2(&a.fa, in, 0)))
+        return e;
+    if (out != -1 && (e = posix_spawn_file_actions_adddup2(&a.fa, out, 1)))
+        return e;
+    if (err != -1 && (e = posix_spawn_file_actions_adddup2(&a.fa, err, 2)))
+        return e;
+#ifdef POSIX_SPAWN_USEVFORK
+    // old glibc uses fork() otherwise
+    posix_spawnattr_setflags(&a.attr, POSIX_SPAWN_USEVFORK);
+#endif
+    return posix_spawn(&pid, argv[0], &a.fa, &a.attr, argv, envp);
+}
+
+#ifndef SW_HAVE_POSIX_SPAWN_CHDIR
+// fallback for changing directory with old libc, returns errno
+static int fork_and_exec(pid_t &pid, char **argv, char **envp, const String &wd, int in, int out, int err)
+{
+    // child reports exec() errors here
+    Fd exec_r, exec_w;
+    if (!make_pipe(exec_r, exec_w))
+        return errno;
+
+    pid = fork();
+    if (pid == -1)
+        return errno;
+    if (pid == 0)
+    {
+        // only async-signal-safe calls below
+        if ((wd.empty() || chdir(wd.c_str()) == 0) &&
+            (in == -1 || dup2(in, 0) != -1) &&
+            (out == -1 || dup2(out, 1) != -1) &&
+            (err == -1 || dup2(err, 2) != -1))
+        {
+            execve(argv[0], argv, envp);
+        }
+        int e = errno;
+        if (write(exec_w.fd, &e, sizeof(e)) == -1)
+            ;
+        _exit(127);
+    }
+    exec_w.close();
+
+    int exec_errno = 0;
+    if (read(exec_r.fd, &exec_errno, sizeof(exec_errno)) == sizeof(exec_errno))
+    {
+        // child is gone already
+        int status;
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+            ;
+        return exec_errno;
+    }
+    return 0;
+}
+#endif
+
+bool executeAndMeasure(primitives::Command &c, std::error_code &ec, ProcessUsage &u, const SpawnArgs *prepared)
+{
+    ec.clear();
+
+    SpawnArgs local;
+    if (!prepared || prepared->empty())
+    {
+        local = makeSpawnArgs(c);
+        prepared = &local;
+    }
+    if (prepared->empty())
+        return false;
+
+    // arena is not modified, so const_cast is fine
+    auto arena = const_cast<char *>(prepared->arena.data());
+    std::vector<char *> argv;
+    argv.reserve(prepared->argv.size() + 1);
+    for (auto o : prepared->argv)
+        argv.push_back(arena + o);
+    argv.push_back(nullptr);
+
+    std::vector<char *> envp;
+    char **envp_ptr = environ;
+    if (!prepared->envp.empty())
+    {
+        envp.reserve(prepared->envp.size() + 1);
+        for (auto o : prepared->envp)
+            envp.push_back(arena + o);
+        envp.push_back(nullptr);
+        envp_ptr = envp.data();
+    }
+
+    auto wd = c.working_directory.u8string();
+
+    auto set_errno = [&ec]()
+    {
+        ec = std::error_code(errno, std::generic_category());
+        return true;
+    };
+
+    // child side fds, -1 = inherit
+    Fd in, out, err;
+    // parent side pipe ends
+    Fd out_pipe, err_pipe;
+    if (!c.in.file.empty())
+    {
+        in.fd = open(c.in.file.u8string().c_str(), O_RDONLY | O_CLOEXEC);
+        if (in.fd == -1)
+            return set_errno();
+    }
+    auto open_output = [](auto &s, Fd &child, Fd &parent)
+    {
+        if (s.inherit)
+            return true;
+        if (s.file.empty())
+            return make_pipe(parent, child);
+        child.fd = open(s.file.u8string().c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (s.append ? O_APPEND : O_TRUNC), 0666);
+        return child.fd != -1;
+    };
+    if (!open_output(c.out, out, out_pipe) || !open_output(c.err, err, err_pipe))
+        return set_errno();
+
+    pid_t pid = -1;
+#ifdef SW_HAVE_POSIX_SPAWN_CHDIR
+    auto start = spawn;
+#else
+    auto start = wd.empty() ? spawn : fork_and_exec;
+#endif
+    if (auto e = start(pid, argv.data(), envp_ptr, wd, in.fd, out.fd, err.fd))
+    {
+        ec = std::error_code(e, std::generic_category());
+        return true;
+    }
+    c.pid = pid;
+
+    in.close();
+    out.close();
+    err.close();
+
+    // capture output
+    pollfd fds[2];
+    String *texts[2];
+    nfds_t n = 0;
+    if (out_pipe.fd != -1)
+    {
+        fds[n] = { out_pipe.fd, POLLIN, 0 };
+        texts[n++] = &c.out.text;
+    }
+    if (err_pipe.fd != -1)
+    {
+        fds[n] = { err_pipe.fd, POLLIN, 0 };
+        texts[n++] = &c.err.text;
+    }
+    char buf[8192];
+    size_t open_fds = n;
+    while (open_fds)
+    {
+        if (poll(fds, n, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (nfds_t i = 0; i < n; i++)
+        {
+            if (fds[i].fd == -1 || !fds[i].revents)
+                continue;
+            auto r = read(fds[i].fd, buf, sizeof(buf));
+            if (r > 0)
+                texts[i]->append(buf, r);
+            else if (r == 0 || errno != EINTR)
+            {
+                fds[i].fd = -1; // closed by Fd
+                open_fds--;
+            }
+        }
+    }
+
+    int status = 0;
+    rusage ru{};
+    while (wait4(pid, &status, 0, &ru) == -1)
+    {
+        if (errno != EINTR)
+            return set_errno();
+    }
+
+    u.user = to_us(ru.ru_utime);
+    u.sys = to_us(ru.ru_stime);
+#ifdef __APPLE__
+    u.peak_rss = ru.ru_maxrss; // bytes
+#else
+    u.peak_rss = (uint64_t)ru.ru_maxrss * 1024; // kilobytes
+#endif
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    c.exit_code = code;
+    if (code)
+        ec = make_process_exit_error(code);
+    return true;
+}
+
+#else
+
+SpawnArgs makeSpawnArgs(const primitives::Command &)
+{
+    return {};
+}
+
+bool executeAndMeasure(primitives::Command &, std::error_code &, ProcessUsage &, const SpawnArgs *)
+{
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,64 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/command.h>
+
+namespace sw
+{
+
+/// resource usage of finished child process
+struct ProcessUsage
+{
+    uint64_t user = 0; // us
+    uint64_t sys = 0; // us
+    uint64_t peak_rss = 0; // bytes
+};
+
+/// argv and envp of a command serialized once into one buffer
+struct SpawnArgs
+{
+    String arena; // zero terminated strings
+    std::vector<uint32_t> argv; // offsets in arena
+    std::vector<uint32_t> envp; // empty = inherit environment
+
+    bool empty() const { return argv.empty(); }
+};
+
+/// returns empty args if the command cannot be spawned directly
+SW_BUILDER_API
+SpawnArgs makeSpawnArgs(const primitives::Command &);
+
+/// runs command in a child process and waits for it with wait4()
+///
+/// Process is started with posix_spawn().
+/// Prepared args must be made from the same arguments and environment,
+/// otherwise they are made here.
+/// Returns false if the command cannot be run this way (unsupported platform,
+/// relative program path), then caller must use primitives::Command::execute().
+/// Otherwise sets pid, exit code, captured output and usage,
+/// errors are reported via 'ec' like in primitives::Command::execute().
+SW_BUILDER_API
+bool executeAndMeasure(primitives::Command &, std::error_code &ec, ProcessUsage &, const SpawnArgs *prepared = nullptr);
+
+/// error for non zero exit code of a process
+SW_BUILDER_API
+std::error_code make_process_exit_error(int code);
+
+}
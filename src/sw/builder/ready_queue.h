@@ -0,0 +1,117 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace sw
+{
+
+/// lock-free multi-producer multi-consumer queue of ready items
+///
+/// Items are dense ranks in [0, n), rank 0 is the most important one.
+/// Storage is a two-level bitmap, so pop() always returns the best item
+/// available at the moment and the queue takes n bits of memory.
+struct ReadyQueue
+{
+    ReadyQueue(size_t n)
+        : n_words((n + 63) / 64)
+        , n_summary((n_words + 63) / 64)
+        , words(std::make_unique<std::atomic<uint64_t>[]>(n_words))
+        , summary(std::make_unique<std::atomic<uint64_t>[]>(n_summary))
+    {
+        for (size_t i = 0; i < n_words; i++)
+            words[i] = 0;
+        for (size_t i = 0; i < n_summary; i++)
+            summary[i] = 0;
+    }
+
+    void push(size_t rank)
+    {
+        auto w = rank / 64;
+        words[w].fetch_or(bit(rank % 64));
+        // summary goes second, so item is visible when summary bit is set
+        summary[w / 64].fetch_or(bit(w % 64));
+    }
+
+    /// returns false if no items were found
+    bool pop(size_t &rank)
+    {
+        for (size_t s = 0; s < n_summary; s++)
+        {
+            auto sv = summary[s].load();
+            while (sv)
+            {
+                auto w = s * 64 + ctz(sv);
+                auto wv = words[w].load();
+                while (wv)
+                {
+                    auto lowest = wv & (~wv + 1);
+                    if (!words[w].compare_exchange_weak(wv, wv & ~lowest))
+                        continue; // wv is reloaded
+                    if ((wv & ~lowest) == 0)
+                        clearSummary(w);
+                    rank = w * 64 + ctz(lowest);
+                    return true;
+                }
+                clearSummary(w);
+                sv &= sv - 1;
+            }
+        }
+        return false;
+    }
+
+private:
+    size_t n_words;
+    size_t n_summary;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    std::unique_ptr<std::atomic<uint64_t>[]> summary;
+
+    void clearSummary(size_t w)
+    {
+        summary[w / 64].fetch_and(~bit(w % 64));
+        // concurrent push might have happened between our check and the clear
+        if (words[w].load())
+            summary[w / 64].fetch_or(bit(w % 64));
+    }
+
+    static uint64_t bit(size_t i)
+    {
+        return 1ULL << i;
+    }
+
+    static size_t ctz(uint64_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward64(&i, v);
+        return i;
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+};
+
+}
@@ -0,0 +1,149 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "remote_action_cache.h"
+
+namespace sw
+{
+
+void toProto(const std::vector<ActionCache::CachedFile> &files, google::protobuf::RepeatedPtrField<api::build::CachedFile> &p)
+{
+    for (auto &f : files)
+    {
+        auto pf = p.Add();
+        pf->set_path(f.path);
+        toProto(f.hash, *pf->mutable_hash());
+    }
+}
+
+std::vector<ActionCache::CachedFile> fromProto(const google::protobuf::RepeatedPtrField<api::build::CachedFile> &p)
+{
+    std::vector<ActionCache::CachedFile> files;
+    for (auto &pf : p)
+        files.push_back({ pf.path(), fromProto(pf.hash()) });
+    return files;
+}
+
+void toProto(const ActionCache::Action &a, api::build::ActionResult &p)
+{
+    toProto(a.implicit_inputs, *p.mutable_implicit_inputs());
+    toProto(a.outputs, *p.mutable_outputs());
+}
+
+ActionCache::Action fromProto(const api::build::ActionResult &p)
+{
+    ActionCache::Action a;
+    a.implicit_inputs = fromProto(p.implicit_inputs());
+    a.outputs = fromProto(p.outputs());
+    return a;
+}
+
+void checkStatus(const grpc::Status &status, const String &method)
+{
+    if (!status.ok())
+        throw SW_RUNTIME_ERROR("Remote call " + method + " failed: " + status.error_message());
+}
+
+grpc::Status serveFindMissingBlobs(const ActionCache &ac, const api::build::FindMissingBlobsRequest &request,
+    api::build::FindMissingBlobsResponse &response)
+{
+    for (auto &h : request.hashes())
+    {
+        if (!ac.hasBlob(fromProto(h)))
+            *response.add_hashes() = h;
+    }
+    return grpc::Status::OK;
+}
+
+grpc::Status serveReadBlob(const ActionCache &ac, const api::build::ReadBlobRequest &request,
+    grpc::ServerWriter<api::build::BlobChunk> &writer)
+{
+    std::ifstream ifile(ac.getBlobFilename(fromProto(request.hash())), std::ios::binary);
+    if (!ifile)
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, "no blob");
+    api::build::BlobChunk chunk;
+    String buf(BLOB_CHUNK_SIZE, 0);
+    do
+    {
+        ifile.read(buf.data(), buf.size());
+        chunk.set_data(buf.data(), ifile.gcount());
+        if (!writer.Write(chunk))
+            return grpc::Status(grpc::StatusCode::CANCELLED, "client closed the stream");
+    } while (ifile);
+    return grpc::Status::OK;
+}
+
+grpc::Status serveWriteBlob(ActionCache &ac, grpc::ServerReader<api::build::BlobChunk> &reader)
+{
+    api::build::BlobChunk chunk;
+    if (!reader.Read(&chunk) || !chunk.has_hash())
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "no blob hash");
+    auto h = fromProto(chunk.hash());
+
+    auto tmp = ac.getTemporaryFilename();
+    {
+        std::ofstream ofile(tmp, std::ios::binary);
+        do
+            ofile.write(chunk.data().data(), chunk.data().size());
+        while (reader.Read(&chunk));
+        if (!ofile)
+            return grpc::Status(grpc::StatusCode::INTERNAL, "cannot write blob");
+    }
+    try
+    {
+        ac.addBlob(h, tmp);
+    }
+    catch (std::exception &e)
+    {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+    }
+    return grpc::Status::OK;
+}
+
+RemoteActionCache::RemoteActionCache(const String &address)
+    : c(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()))
+    , stub(api::build::ActionCacheService::NewStub(c))
+{
+}
+
+std::optional<ActionCache::Action> RemoteActionCache::getActionResult(const Hash128 &key) const
+{
+    api::build::GetActionResultRequest request;
+    toProto(key, *request.mutable_action_key());
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(10);
+    api::build::ActionResult response;
+    auto status = stub->GetActionResult(context.get(), request, &response);
+    if (status.error_code() == grpc::StatusCode::NOT_FOUND)
+        return {};
+    checkStatus(status, "GetActionResult");
+    return fromProto(response);
+}
+
+void RemoteActionCache::updateActionResult(const Hash128 &key, const ActionCache::Action &a) const
+{
+    api::build::UpdateActionResultRequest request;
+    toProto(key, *request.mutable_action_key());
+    toProto(a, *request.mutable_result());
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(10);
+    google::protobuf::Empty response;
+    checkStatus(stub->UpdateActionResult(context.get(), request, &response), "UpdateActionResult");
+}
+
+}
@@ -0,0 +1,161 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "action_cache.h"
+
+#include <grpcpp/grpcpp.h>
+
+#include <sw/protocol/build.grpc.pb.h>
+#include <sw/protocol/grpc_helpers.h>
+
+#include <primitives/exceptions.h>
+
+#include <fstream>
+
+#define BLOB_CHUNK_SIZE (1024 * 1024)
+
+namespace sw
+{
+
+inline void toProto(const Hash128 &h, api::build::Hash &p)
+{
+    p.set_low(h.low);
+    p.set_high(h.high);
+}
+
+inline Hash128 fromProto(const api::build::Hash &p)
+{
+    Hash128 h;
+    h.low = p.low();
+    h.high = p.high();
+    return h;
+}
+
+SW_BUILDER_API
+void toProto(const std::vector<ActionCache::CachedFile> &, google::protobuf::RepeatedPtrField<api::build::CachedFile> &);
+SW_BUILDER_API
+std::vector<ActionCache::CachedFile> fromProto(const google::protobuf::RepeatedPtrField<api::build::CachedFile> &);
+
+SW_BUILDER_API
+void toProto(const ActionCache::Action &, api::build::ActionResult &);
+SW_BUILDER_API
+ActionCache::Action fromProto(const api::build::ActionResult &);
+
+/// throws on errors
+SW_BUILDER_API
+void checkStatus(const grpc::Status &, const String &method);
+
+// blob methods are the same in ActionCacheService and DistributedBuildService
+
+SW_BUILDER_API
+grpc::Status serveFindMissingBlobs(const ActionCache &, const api::build::FindMissingBlobsRequest &, api::build::FindMissingBlobsResponse &);
+SW_BUILDER_API
+grpc::Status serveReadBlob(const ActionCache &, const api::build::ReadBlobRequest &, grpc::ServerWriter<api::build::BlobChunk> &);
+SW_BUILDER_API
+grpc::Status serveWriteBlob(ActionCache &, grpc::ServerReader<api::build::BlobChunk> &);
+
+namespace detail
+{
+
+template <class Stub>
+std::vector<Hash128> findMissingBlobs(Stub &stub, const std::vector<Hash128> &hashes)
+{
+    api::build::FindMissingBlobsRequest request;
+    for (auto &h : hashes)
+        toProto(h, *request.add_hashes());
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(10);
+    api::build::FindMissingBlobsResponse response;
+    checkStatus(stub.FindMissingBlobs(context.get(), request, &response), "FindMissingBlobs");
+    std::vector<Hash128> missing;
+    for (auto &h : response.hashes())
+        missing.push_back(fromProto(h));
+    return missing;
+}
+
+template <class Stub>
+void readBlob(Stub &stub, const Hash128 &h, const path &to)
+{
+    api::build::ReadBlobRequest request;
+    toProto(h, *request.mutable_hash());
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(300);
+    auto reader = stub.ReadBlob(context.get(), request);
+
+    std::ofstream ofile(to, std::ios::binary);
+    if (!ofile)
+        throw SW_RUNTIME_ERROR("Cannot open file for writing: " + normalize_path(to));
+    api::build::BlobChunk chunk;
+    while (reader->Read(&chunk))
+        ofile.write(chunk.data().data(), chunk.data().size());
+    checkStatus(reader->Finish(), "ReadBlob");
+    ofile.close();
+    if (!ofile)
+        throw SW_RUNTIME_ERROR("Cannot write file: " + normalize_path(to));
+}
+
+template <class Stub>
+void writeBlob(Stub &stub, const Hash128 &h, const path &from)
+{
+    std::ifstream ifile(from, std::ios::binary);
+    if (!ifile)
+        throw SW_RUNTIME_ERROR("Cannot open file for reading: " + normalize_path(from));
+
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(300);
+    google::protobuf::Empty response;
+    auto writer = stub.WriteBlob(context.get(), &response);
+
+    api::build::BlobChunk chunk;
+    toProto(h, *chunk.mutable_hash());
+    String buf(BLOB_CHUNK_SIZE, 0);
+    do
+    {
+        ifile.read(buf.data(), buf.size());
+        chunk.set_data(buf.data(), ifile.gcount());
+        if (!writer->Write(chunk))
+            break; // server closed the stream, status tells why
+        chunk.clear_hash();
+    } while (ifile);
+    writer->WritesDone();
+    checkStatus(writer->Finish(), "WriteBlob");
+}
+
+} // namespace detail
+
+/// client of ActionCacheService
+///
+/// All methods throw on network errors.
+struct RemoteActionCache
+{
+    RemoteActionCache(const String &address);
+
+    std::optional<ActionCache::Action> getActionResult(const Hash128 &key) const;
+    void updateActionResult(const Hash128 &key, const ActionCache::Action &) const;
+    std::vector<Hash128> findMissingBlobs(const std::vector<Hash128> &hashes) const { return detail::findMissingBlobs(*stub, hashes); }
+    void readBlob(const Hash128 &h, const path &to) const { detail::readBlob(*stub, h, to); }
+    void writeBlob(const Hash128 &h, const path &from) const { detail::writeBlob(*stub, h, from); }
+
+private:
+    std::shared_ptr<grpc::Channel> c;
+    std::unique_ptr<api::build::ActionCacheService::Stub> stub;
+};
+
+}
@@ -0,0 +1,167 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "remote_executor.h"
+
+#include "remote_action_cache.h"
+
+#include <boost/algorithm/string.hpp>
+#include <primitives/exceptions.h>
+#include <primitives/templates.h>
+
+#include <algorithm>
+
+namespace sw
+{
+
+struct RemoteExecutor::Worker
+{
+    String address;
+    int slots = 1;
+    int running = 0; // guarded by executor mutex
+    std::shared_ptr<grpc::Channel> c;
+    std::unique_ptr<api::build::DistributedBuildService::Stub> stub;
+};
+
+RemoteExecutor::RemoteExecutor(const String &s)
+{
+    Strings v;
+    boost::split(v, s, boost::is_any_of(","));
+    for (auto &a : v)
+    {
+        boost::trim(a);
+        if (a.empty())
+            continue;
+        auto w = std::make_unique<Worker>();
+        w->address = a;
+        if (auto p = a.rfind('/'); p != a.npos)
+        {
+            w->address = a.substr(0, p);
+            w->slots = std::stoi(a.substr(p + 1));
+            if (w->slots < 1)
+                throw SW_RUNTIME_ERROR("Bad number of worker slots: " + a);
+        }
+        w->c = grpc::CreateChannel(w->address, grpc::InsecureChannelCredentials());
+        w->stub = api::build::DistributedBuildService::NewStub(w->c);
+        workers.push_back(std::move(w));
+    }
+    if (workers.empty())
+        throw SW_RUNTIME_ERROR("No remote workers were specified");
+}
+
+RemoteExecutor::~RemoteExecutor()
+{
+}
+
+int RemoteExecutor::getNumberOfSlots() const
+{
+    int n = 0;
+    for (auto &w : workers)
+        n += w->slots;
+    return n;
+}
+
+RemoteExecutor::Worker &RemoteExecutor::acquire()
+{
+    // admission control limits remote commands by total number of slots,
+    // so here we only spread them
+    std::unique_lock lk(m);
+    auto w = std::min_element(workers.begin(), workers.end(), [](auto &a, auto &b)
+    {
+        return a->running * b->slots < b->running * a->slots;
+    });
+    (*w)->running++;
+    return **w;
+}
+
+void RemoteExecutor::release(Worker &w)
+{
+    std::unique_lock lk(m);
+    w.running--;
+}
+
+RemoteExecutor::Result RemoteExecutor::execute(const Request &rq)
+{
+    auto &w = acquire();
+    SCOPE_EXIT
+    {
+        release(w);
+    };
+
+    // upload inputs
+    std::map<Hash128, const ActionCache::CachedFile *> files;
+    for (auto &i : rq.inputs)
+        files[i.hash] = &i;
+    std::vector<Hash128> hashes;
+    for (auto &[h, _] : files)
+        hashes.push_back(h);
+    // worker checks hashes, so files changed after hashing are not used
+    for (auto &h : detail::findMissingBlobs(*w.stub, hashes))
+        detail::writeBlob(*w.stub, h, fs::u8path(files[h]->path));
+
+    api::build::Command request;
+    request.set_program(rq.arguments.at(0));
+    for (auto a = rq.arguments.begin() + 1; a != rq.arguments.end(); a++)
+        request.add_arguments(*a);
+    for (auto &[k, v] : rq.environment)
+        (*request.mutable_environment())[k] = v;
+    request.set_working_directory(normalize_path(rq.working_directory));
+    toProto(rq.inputs, *request.mutable_inputs());
+    for (auto &o : rq.outputs)
+        request.add_outputs(o);
+    toProto(rq.program_hash, *request.mutable_program_hash());
+
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(3600);
+    api::build::CommandResult response;
+    checkStatus(w.stub->ExecuteCommand(context.get(), request, &response), "ExecuteCommand on " + w.address);
+
+    // download outputs
+    for (auto &o : fromProto(response.outputs()))
+    {
+        auto p = fs::u8path(o.path);
+        // worker on the same machine writes them in place
+        if (fs::exists(p) && hash128(read_file(p)) == o.hash)
+            continue;
+        fs::create_directories(p.parent_path());
+        auto tmp = p.parent_path() / unique_path();
+        tmp += ".tmp";
+        try
+        {
+            detail::readBlob(*w.stub, o.hash, tmp);
+            if (hash128(read_file(tmp)) != o.hash)
+                throw SW_RUNTIME_ERROR("Downloaded output does not match its hash: " + o.path);
+            fs::rename(tmp, p);
+        }
+        catch (...)
+        {
+            error_code ec;
+            fs::remove(tmp, ec);
+            throw;
+        }
+    }
+
+    Result r;
+    r.exit_code = (int)response.exit_code();
+    r.out = response.out();
+    r.err = response.err();
+    executed++;
+    return r;
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "action_cache.h"
+
+#include <map>
+#include <mutex>
+
+namespace sw
+{
+
+/// runs commands on DistributedBuildService workers
+///
+/// Inputs are uploaded by content hash, workers keep them in their blobs.
+/// Outputs are downloaded into their local paths.
+/// Workers must have the same programs and directory layout.
+struct SW_BUILDER_API RemoteExecutor
+{
+    struct Request
+    {
+        Strings arguments; // program goes first
+        Hash128 program_hash;
+        std::map<String, String> environment;
+        path working_directory;
+        std::vector<ActionCache::CachedFile> inputs;
+        Strings outputs; // normalized
+    };
+
+    struct Result
+    {
+        int exit_code = 0;
+        String out;
+        String err;
+    };
+
+    std::atomic_size_t executed = 0;
+    // run locally after remote error
+    std::atomic_size_t failed = 0;
+
+    /// comma separated list of host:port, number of slots may follow, e.g. host:port/8
+    RemoteExecutor(const String &workers);
+    ~RemoteExecutor();
+
+    int getNumberOfSlots() const;
+
+    /// throws on worker and network errors, then command may be run locally
+    Result execute(const Request &);
+
+private:
+    struct Worker;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex m;
+
+    Worker &acquire();
+    void release(Worker &);
+};
+
+}
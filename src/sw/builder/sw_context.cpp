@@ -18,8 +18,10 @@
 
 #include "sw_context.h"
 
+#include "action_cache.h"
 #include "command_storage.h"
 #include "file_storage.h"
+#include "remote_executor.h"
 
 #include <sw/manager/storage.h>
 
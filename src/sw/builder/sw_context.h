@@ -28,13 +28,26 @@ struct Executor;
 namespace sw
 {
 
+struct ActionCache;
 struct CommandStorage;
 struct FileStorage;
+struct RemoteExecutor;
 
 namespace builder::detail { struct ResolvableCommand; }
 
 struct SW_BUILDER_API SwBuilderContext
 {
+    // fsync command logs after every batch
+    bool sync_command_log = false;
+    // compare content hashes of inputs that are newer than command
+    bool content_hash_check = false;
+    // hash outputs, dependents are not run when they are the same
+    bool early_cutoff = false;
+    // restore outputs of cacheable commands, when set
+    std::unique_ptr<ActionCache> action_cache;
+    // run remote capable commands on workers, when set
+    std::unique_ptr<RemoteExecutor> remote_executor;
+
     SwBuilderContext();
     ~SwBuilderContext();
 
@@ -1296,7 +1296,8 @@ void RawBootstrapBuildGenerator::generate(const sw::SwBuild &b)
     {
         auto &c = dynamic_cast<const sw::builder::Command &>(*c1);
         files.insert(c.inputs.begin(), c.inputs.end());
-        files.insert(c.implicit_inputs.begin(), c.implicit_inputs.end());
+        for (auto i : c.implicit_inputs)
+            files.insert(sw::getPathInterner().getPath(i));
     }
 
     LOG_INFO(logger, "Filtering files");
@@ -412,6 +412,13 @@ std::unique_ptr<sw::SwBuild> SwClientContext::createBuildInternal()
         bs["skip_errors"] = std::to_string(options.skip_errors);
 
     SET_BOOL_OPTION(time_trace);
+    SET_BOOL_OPTION(plan_cache);
+    SET_BOOL_OPTION(prepared_cache);
+    SET_BOOL_OPTION(transitive_reduction);
+    SET_BOOL_OPTION(sync_command_log);
+    SET_BOOL_OPTION(content_hash_check);
+    SET_BOOL_OPTION(early_cutoff);
+    SET_BOOL_OPTION(action_cache);
     SET_BOOL_OPTION(show_output);
     SET_BOOL_OPTION(write_output_to_file);
 
@@ -441,6 +448,16 @@ std::unique_ptr<sw::SwBuild> SwClientContext::createBuildInternal()
         bs["build-jobs"] = std::to_string(select_number_of_threads(options.build_jobs));
     if (options.prepare_jobs)
         bs["prepare-jobs"] = std::to_string(select_number_of_threads(options.prepare_jobs));
+    if (options.link_jobs)
+        bs["link-jobs"] = std::to_string(options.link_jobs);
+    if (options.build_memory)
+        bs["build-memory"] = std::to_string(options.build_memory);
+    if (options.action_cache_size)
+        bs["action-cache-size"] = std::to_string(options.action_cache_size);
+    if (!options.action_cache_remote.empty())
+        bs["action-cache-remote"] = options.action_cache_remote;
+    if (!options.remote_workers.empty())
+        bs["remote-workers"] = options.remote_workers;
     for (auto &t : options.Dvariables)
     {
         auto p = t.find('=');
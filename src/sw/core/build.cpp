@@ -20,10 +20,13 @@
 
 #include "driver.h"
 #include "input.h"
+#include "prepare.h"
 #include "sw_context.h"
 
+#include <sw/builder/action_cache.h>
 #include <sw/builder/execution_plan.h>
 #include <sw/builder/jumppad.h>
+#include <sw/builder/remote_executor.h>
 #include <sw/manager/storage.h>
 
 #include <boost/current_function.hpp>
@@ -32,6 +35,8 @@
 #include <primitives/date_time.h>
 #include <primitives/executor.h>
 
+#include <sstream>
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "build");
 
@@ -121,6 +126,296 @@ static auto can_use_saved_configs(const SwBuild &b)
         ;
 }
 
+static auto get_prepared_target_dir(const SwBuild &b, const ITarget &t)
+{
+    return b.getBuildDirectory() / "pt" / t.getPackage().toString() / t.getSettings().getHash();
+}
+
+// Prepared state of a local target depends on its settings, input (config),
+// list of its files and on its deps, so deps are hashed with their own keys.
+// Contents of files do not matter here, they are checked by commands.
+// Only local targets with known keys are returned.
+static auto get_prepared_target_keys(const SwBuild &b)
+{
+    std::unordered_map<const ITarget *, const TargetContainer *> local;
+    for (const auto &[pkg, tgts] : b.getTargets())
+    {
+        if (!pkg.getPath().isRelative() || !tgts.hasInput())
+            continue;
+        for (auto &tgt : tgts)
+            local[tgt.get()] = &tgts;
+    }
+
+    // empty key means that target cannot be cached (unresolved deps, cycles)
+    std::unordered_map<const ITarget *, Hash128> keys;
+    std::function<Hash128(const ITarget &)> get_key;
+    get_key = [&local, &keys, &get_key](const ITarget &t)
+    {
+        auto i = keys.find(&t);
+        if (i != keys.end())
+            return i->second;
+
+        Hasher h;
+        auto l = local.find(&t);
+        if (l == local.end())
+        {
+            // packages do not change
+            h.add(t.getPackage().toString());
+            h.add(t.getSettings().getHash());
+            return keys[&t] = h.digest();
+        }
+        keys[&t] = {};
+
+        h.add(t.getSettings().getHash());
+        h.add((uint64_t)l->second->getInput().getInput().getHash());
+        Strings files;
+        for (auto &f : t.getSourceFiles())
+            files.push_back(normalize_path(f));
+        std::sort(files.begin(), files.end());
+        for (auto &f : files)
+            h.add(f);
+        std::vector<Hash128> deps;
+        for (auto d : t.getDependencies())
+        {
+            if (!d->isResolved())
+                return Hash128{};
+            auto k = get_key(d->getTarget());
+            if (!k)
+                return Hash128{};
+            deps.push_back(k);
+        }
+        std::sort(deps.begin(), deps.end());
+        for (auto &k : deps)
+            h.add(k);
+        return keys[&t] = h.digest();
+    };
+
+    for (auto &[t, tgts] : local)
+        get_key(*t);
+    for (auto i = keys.begin(); i != keys.end();)
+    {
+        if (!i->second || local.find(i->first) == local.end())
+            i = keys.erase(i);
+        else
+            ++i;
+    }
+    return keys;
+}
+
+static std::shared_ptr<PreparedTarget> load_prepared_target(const SwBuild &b, const ITargetPtr &t, const Hash128 &key)
+{
+    auto base = get_prepared_target_dir(b, *t);
+    auto kfn = base / "key";
+    if (!fs::exists(kfn) || read_file(kfn) != key.toString())
+        return {};
+
+    LOG_TRACE(logger, "loading " << t->getPackage().toString() << ": " << t->getSettings().getHash() << " from prepared state");
+
+    auto tgt = std::make_shared<PreparedTarget>(t->getPackage(), t->getSettings());
+    TargetSettings its;
+    its.mergeFromString(read_file(base / "settings.json"));
+    tgt->public_ts = its;
+    auto sets = loadCommandSets(base / "commands", 1);
+    if (sets.size() != 3)
+        throw SW_RUNTIME_ERROR("Bad prepared state");
+    tgt->commands = sets[0];
+    tgt->generated_commands = sets[1];
+    tgt->tests = sets[2];
+    std::istringstream edges(read_file(base / "edges"));
+    size_t c, d;
+    while (edges >> c >> d)
+        tgt->deps_generated_edges.emplace_back(c, d);
+    for (auto cmds : { &tgt->commands, &tgt->generated_commands, &tgt->tests })
+    {
+        for (auto &c : *cmds)
+        {
+            c->setContext(b);
+            if (!c->command_storage_root.empty())
+                c->command_storage = &b.getCommandStorage(c->command_storage_root);
+        }
+    }
+    tgt->loaded = t;
+    return tgt;
+}
+
+// replaces unchanged local targets with their prepared state,
+// returns keys of targets that must be prepared
+static auto load_prepared_targets(SwBuild &b)
+{
+    auto keys = get_prepared_target_keys(b);
+
+    std::vector<ITargetPtr> tgts;
+    for (const auto &[pkg, tgts2] : b.getTargets())
+    {
+        for (auto &tgt : tgts2)
+        {
+            if (keys.find(tgt.get()) != keys.end())
+                tgts.push_back(tgt);
+        }
+    }
+
+    std::unordered_map<const ITarget *, PreparedTarget *> replaced;
+    for (auto &t : tgts)
+    {
+        std::shared_ptr<PreparedTarget> tgt;
+        try
+        {
+            tgt = load_prepared_target(b, t, keys[t.get()]);
+        }
+        catch (std::exception &e)
+        {
+            LOG_DEBUG(logger, "cannot load prepared state of " << t->getPackage().toString() << ": " << e.what());
+        }
+        if (!tgt)
+            continue;
+
+        auto &pkg = t->getPackage();
+        b.getTargets()[pkg].push_back(tgt);
+        auto i = b.getTargetsToBuild().find(pkg);
+        if (i != b.getTargetsToBuild().end() && i->second.findEqual(tgt->getSettings()) != i->second.end())
+            i->second.push_back(tgt);
+        replaced[t.get()] = tgt.get();
+        keys.erase(t.get());
+    }
+    if (replaced.empty())
+        return keys;
+
+    // point dependencies to the new targets
+    for (const auto &[pkg, tgts] : b.getTargets())
+    {
+        for (auto &tgt : tgts)
+        {
+            if (replaced.find(tgt.get()) != replaced.end())
+                continue;
+            for (auto d : tgt->getDependencies())
+            {
+                if (!d->isResolved())
+                    continue;
+                auto i = replaced.find(&d->getTarget());
+                if (i != replaced.end())
+                    d->setTarget(*i->second);
+            }
+        }
+    }
+    for (auto &[loaded, tgt] : replaced)
+    {
+        for (auto d : tgt->getDependencies())
+        {
+            auto t = b.getTargets().find(d->getUnresolvedPackage(), d->getSettings());
+            if (!t)
+                t = b.getContext().getPredefinedTargets().find(d->getUnresolvedPackage(), d->getSettings());
+            if (t)
+                d->setTarget(*t);
+        }
+    }
+
+    LOG_DEBUG(logger, "loaded prepared state of " << replaced.size() << " targets");
+    return keys;
+}
+
+// adds recorded edges of loaded targets to generated commands of their deps,
+// must be called once after deps are prepared
+static void restore_prepared_edges(const SwBuild &b)
+{
+    for (const auto &[pkg, tgts] : b.getTargets())
+    {
+        for (auto &tgt : tgts)
+        {
+            auto pt = tgt->as<PreparedTarget *>();
+            if (!pt || pt->deps_generated_edges.empty())
+                continue;
+
+            std::unordered_multimap<size_t, std::shared_ptr<builder::Command>> own, generated;
+            for (auto cmds : { &pt->commands, &pt->generated_commands, &pt->tests })
+            {
+                for (auto &c : *cmds)
+                    own.emplace(c->getHash(), c);
+            }
+            auto deps_generated = PreparedTarget::getDependenciesGeneratedCommands(*pt);
+            for (auto &c : deps_generated)
+                generated.emplace(c->getHash(), c);
+
+            for (auto &[ch, dh] : pt->deps_generated_edges)
+            {
+                auto [c1, c2] = own.equal_range(ch);
+                auto [d1, d2] = generated.equal_range(dh);
+                for (auto c = c1; c != c2; ++c)
+                {
+                    // generated command has changed, so we keep the order with all of them
+                    if (d1 == d2)
+                    {
+                        LOG_TRACE(logger, pt->getPackage().toString() << ": generated command of deps is not found, depending on all of them");
+                        c->second->dependencies.insert(deps_generated.begin(), deps_generated.end());
+                        continue;
+                    }
+                    for (auto d = d1; d != d2; ++d)
+                        c->second->dependencies.insert(d->second);
+                }
+            }
+        }
+    }
+}
+
+static void save_prepared_target(const SwBuild &b, const ITarget &t, const Hash128 &key)
+{
+    auto base = get_prepared_target_dir(b, t);
+    // key is written last, it marks complete state
+    if (fs::exists(base / "key"))
+        fs::remove(base / "key");
+
+    auto cmds = t.getCommands();
+    auto generated = t.getGeneratedCommands();
+    auto tests = t.getTests();
+    Commands all = cmds;
+    all.insert(generated.begin(), generated.end());
+    all.insert(tests.begin(), tests.end());
+
+    // edges between saved commands are kept by the archive,
+    // edges to generated commands of deps are recorded by command hashes and restored after prepare,
+    // other edges to commands of other targets cannot be restored
+    std::unordered_set<const CommandNode *> own, deps_generated;
+    for (auto &c : all)
+        own.insert(c.get());
+    for (auto &c : PreparedTarget::getDependenciesGeneratedCommands(t))
+        deps_generated.insert(c.get());
+    String edges;
+    for (auto &c : all)
+    {
+        for (auto &d : c->dependencies)
+        {
+            if (own.find(d.get()) != own.end())
+                continue;
+            if (deps_generated.find(d.get()) == deps_generated.end())
+            {
+                LOG_TRACE(logger, "not saving prepared state of " << t.getPackage().toString() << ": command depends on other targets");
+                return;
+            }
+            edges += std::to_string(c->getHash()) + " " + std::to_string(d->getHash()) + "\n";
+        }
+    }
+
+    fs::create_directories(base);
+    write_file(base / "settings.json", nlohmann::json::parse(t.getInterfaceSettings().toString()).dump(2));
+    saveCommandSets(base / "commands", { cmds, generated, tests }, 1);
+    write_file(base / "edges", edges);
+    write_file(base / "key", key.toString());
+}
+
+static void save_prepared_targets(const SwBuild &b, const std::unordered_map<const ITarget *, Hash128> &keys)
+{
+    for (auto &[t, key] : keys)
+    {
+        try
+        {
+            save_prepared_target(b, *t, key);
+        }
+        catch (std::exception &e)
+        {
+            LOG_DEBUG(logger, "cannot save prepared state of " << t->getPackage().toString() << ": " << e.what());
+        }
+    }
+}
+
 static std::unordered_map<UnresolvedPackage, PackageId> loadLockFile(const path &fn/*, SwContext &swctx*/)
 {
     auto j = nlohmann::json::parse(read_file(fn));
@@ -259,6 +554,26 @@ static ExecutionPlan::Clock::duration parseTimeLimit(String tl)
     return d;
 }
 
+// shared by all builds of the process
+static WorkStealingExecutor &getSharedBuildExecutor()
+{
+    static WorkStealingExecutor e(::getExecutor().numberOfThreads());
+    return e;
+}
+
+// budget of the shared pool
+static AdmissionControl &getSharedAdmissionControl()
+{
+    static AdmissionControl a([]
+    {
+        ResourceBudget b;
+        b.cpu = getSharedBuildExecutor().numberOfThreads();
+        b.memory = getPhysicalMemorySize();
+        return b;
+    }());
+    return a;
+}
+
 SwBuild::SwBuild(SwContext &swctx, const path &build_dir)
     : swctx(swctx)
     , build_dir(build_dir)
@@ -300,6 +615,18 @@ void SwBuild::build()
 
     ScopedTime t;
 
+    // skip targets preparation if nothing changed since the last build
+    if (build_settings["plan_cache"] == "true")
+    {
+        loadInputs();
+        if (runCachedExecutionPlan())
+        {
+            if (build_settings["measure"] == "true")
+                LOG_DEBUG(logger, BOOST_CURRENT_FUNCTION << " time: " << t.getTimeFloat() << " s.");
+            return;
+        }
+    }
+
     // this is all in one call
     while (step())
         ;
@@ -563,18 +890,35 @@ void SwBuild::loadPackages()
     loadPackages(swctx.getPredefinedTargets());
 }
 
+// packages of one input requested with the same settings, they are loaded at once
+struct PackagesLoad
+{
+    const BuildInput *input = nullptr;
+    PackageIdSet requested;
+    std::vector<ITargetPtr> targets;
+};
+
+// loads of one input
+struct InputLoads
+{
+    bool parallel = false;
+    std::map<TargetSettings, PackagesLoad> loads;
+};
+
 void SwBuild::loadPackages(const TargetMap &predefined)
 {
     // load
     auto usc = can_use_saved_configs(*this);
     //               input hash
     std::unordered_map<size_t, TargetMap> cache;
+    // created on the first parallel load and kept for all rounds
+    std::unique_ptr<Executor> load_executor;
     int r = 1;
     while (!stopped)
     {
         LOG_TRACE(logger, "build id " << this << " " << BOOST_CURRENT_FUNCTION << " round " << r++);
 
-        std::map<TargetSettings, std::pair<PackageId, TargetContainer *>> load;
+        std::map<TargetSettings, std::map<PackageId, TargetContainer *>> load;
         for (const auto &[pkg, tgts] : getTargets())
         {
             for (const auto &tgt : tgts)
@@ -618,41 +962,43 @@ void SwBuild::loadPackages(const TargetMap &predefined)
                         throw SW_LOGIC_ERROR(tgt->getPackage().toString() + ": " + tgt->getSettings().toString() + ": predefined target is not resolved: " + d->getUnresolvedPackage().toString());
                     }
 
-                    load.insert({ d->getSettings(), { i->first, &i->second } });
+                    load[d->getSettings()].emplace(i->first, &i->second);
                 }
             }
         }
         if (load.empty())
             break;
         bool loaded = false;
-        for (auto &[s, d] : load)
+        //                 input hash
+        std::map<size_t, InputLoads> input_loads;
+        for (auto &[s, pkgs] : load)
         {
             // empty settings mean we want dependency only to be present
             if (s.empty())
                 continue;
 
-            if (usc)
+            for (auto &[pkg, tc] : pkgs)
             {
-                LocalPackage p(getContext().getLocalStorage(), d.first);
-                auto tgt = create_target(p, s);
-                if (tgt)
+                if (usc)
                 {
-                    getTargets()[tgt->getPackage()].push_back(tgt);
-                    loaded = true;
-                    continue;
+                    LocalPackage p(getContext().getLocalStorage(), pkg);
+                    auto tgt = create_target(p, s);
+                    if (tgt)
+                    {
+                        getTargets()[tgt->getPackage()].push_back(tgt);
+                        loaded = true;
+                        continue;
+                    }
                 }
-            }
 
-            LOG_TRACE(logger, "build id " << this << " " << BOOST_CURRENT_FUNCTION << " loading " << d.first.toString());
+                loaded = true;
 
-            loaded = true;
-
-            // from cache
-            {
+                // from cache
                 // only if inputs the same
                 // (we might change something in one of the inputs, do not take wrong targets from cache)
-                auto h = getTargets()[d.first].getInput().getInput().getHash();
-                auto i = cache[h].find(d.first);
+                auto &bi = tc->getInput();
+                auto h = bi.getInput().getHash();
+                auto i = cache[h].find(pkg);
                 if (i != cache[h].end())
                 {
                     auto k = i->second.findSuitable(s);
@@ -663,30 +1009,87 @@ void SwBuild::loadPackages(const TargetMap &predefined)
                         continue;
                     }
                 }
+
+                auto &il = input_loads[h];
+                il.parallel = bi.getInput().isParallelLoadable();
+                auto &l = il.loads[s];
+                if (!l.input)
+                    l.input = &bi;
+                l.requested.insert(pkg);
             }
+        }
 
-            auto tgts = getTargets()[d.first].loadPackages(*this, s, getTargets().getPackagesSet());
-            for (auto &tgt : tgts)
+        // loads of different inputs and loads of one input with different settings are independent,
+        // entry points of parallel loadable inputs are safe to call concurrently
+        // (see NativeTargetEntryPoint::createBuild() and CheckSet::performChecks())
+        auto known_packages = getTargets().getPackagesSet();
+        auto load_packages = [this, &known_packages](const TargetSettings &s, PackagesLoad &l)
+        {
+            for (auto &pkg : l.requested)
+                LOG_TRACE(logger, "build id " << this << " " << BOOST_CURRENT_FUNCTION << " loading " << pkg.toString());
+            l.targets = l.input->loadPackages(*this, s, known_packages);
+        };
+        {
+            std::vector<std::pair<const TargetSettings *, PackagesLoad *>> parallel;
+            for (auto &[h, il] : input_loads)
             {
-                if (tgt->getPackage() == d.first)
-                    getTargets()[tgt->getPackage()].push_back(tgt);
-                else
-                {
-                    auto h = getTargets()[d.first].getInput().getInput().getHash();
-                    cache[h][tgt->getPackage()].push_back(tgt);
-                }
+                if (!il.parallel)
+                    continue;
+                for (auto &[s, l] : il.loads)
+                    parallel.emplace_back(&s, &l);
+            }
+            if (parallel.size() > 1 && getPrepareExecutor().numberOfThreads() > 1)
+            {
+                // Loading may run checks that wait for the prepare executor,
+                // so we do not block its threads and use our own ones of the same number.
+                if (!load_executor)
+                    load_executor = std::make_unique<Executor>(getPrepareExecutor().numberOfThreads());
+                Futures<void> fs;
+                for (auto &[s, l] : parallel)
+                    fs.push_back(load_executor->push([&load_packages, s = s, l = l] { load_packages(*s, *l); }));
+                waitAndGet(fs);
             }
+            else
+            {
+                for (auto &[s, l] : parallel)
+                    load_packages(*s, *l);
+            }
+            for (auto &[h, il] : input_loads)
+            {
+                if (il.parallel)
+                    continue;
+                for (auto &[s, l] : il.loads)
+                    load_packages(s, l);
+            }
+        }
 
-            auto k = d.second->findSuitable(s);
-            if (k == d.second->end())
+        // insert in the same order as serial loading does
+        for (auto &[h, il] : input_loads)
+        {
+            for (auto &[s, l] : il.loads)
             {
-                String e;
-                e += d.first.toString() + " with current settings\n" + s.toString();
-                e += "\navailable targets:\n";
-                for (auto &tgt : tgts)
-                    e += tgt->getSettings().toString() + "\n";
-                e.resize(e.size() - 1);
-                throw SW_RUNTIME_ERROR("cannot load package " + e);
+                for (auto &tgt : l.targets)
+                {
+                    if (l.requested.find(tgt->getPackage()) != l.requested.end())
+                        getTargets()[tgt->getPackage()].push_back(tgt);
+                    else
+                        cache[h][tgt->getPackage()].push_back(tgt);
+                }
+
+                for (auto &pkg : l.requested)
+                {
+                    auto &tc = getTargets()[pkg];
+                    auto k = tc.findSuitable(s);
+                    if (k != tc.end())
+                        continue;
+                    String e;
+                    e += pkg.toString() + " with current settings\n" + s.toString();
+                    e += "\navailable targets:\n";
+                    for (auto &tgt : l.targets)
+                        e += tgt->getSettings().toString() + "\n";
+                    e.resize(e.size() - 1);
+                    throw SW_RUNTIME_ERROR("cannot load package " + e);
+                }
             }
         }
         if (!loaded)
@@ -720,11 +1123,41 @@ void SwBuild::prepare()
 {
     CHECK_STATE_AND_CHANGE(BuildState::PackagesLoaded, BuildState::Prepared);
 
-    while (prepareStep() && !stopped)
-        ;
+    // like saved configs, allow only in the main build for now
+    std::unordered_map<const ITarget *, Hash128> prepared_keys;
+    bool prepared_cache = build_settings["prepared_cache"] == "true" && build_settings["master_build"] == "true";
+    if (prepared_cache)
+        prepared_keys = load_prepared_targets(*this);
+
+    {
+        ScopedTime t;
+
+        std::vector<ITarget *> tgts;
+        for (const auto &[pkg, tgts2] : getTargets())
+        {
+            for (const auto &tgt : tgts2)
+                tgts.push_back(tgt.get());
+        }
+        PrepareScheduler s(tgts);
+        s.run(getPrepareExecutor(), stopped);
+
+        if (build_settings["measure"] == "true")
+        {
+            s.printStatistics();
+            LOG_DEBUG(logger, BOOST_CURRENT_FUNCTION << " time: " << t.getTimeFloat() << " s.");
+        }
+        if (build_settings["time_trace"] == "true")
+            s.saveChromeTrace(getBuildDirectory() / "misc" / "prepare_trace.json");
+    }
     if (stopped)
         return;
 
+    if (prepared_cache)
+    {
+        restore_prepared_edges(*this);
+        save_prepared_targets(*this, prepared_keys);
+    }
+
     if (build_settings["master_build"] != "true")
         return;
 
@@ -765,6 +1198,20 @@ void SwBuild::prepare()
 void SwBuild::execute() const
 {
     auto p = getExecutionPlan();
+    if (build_settings["transitive_reduction"] == "true")
+    {
+        ScopedTime t;
+        auto n_edges = p->getNumberOfEdges();
+        p->transitiveReduction();
+        if (build_settings["measure"] == "true")
+            LOG_DEBUG(logger, "transitive reduction: " << n_edges << " -> " << p->getNumberOfEdges() << " edges, time: " << t.getTimeFloat() << " s.");
+    }
+    if (build_settings["plan_cache"] == "true")
+    {
+        // save before execution, so failed builds also reuse the plan
+        p->save(getExecutionPlanPath());
+        p->saveSnapshot(getExecutionPlanSnapshotPath(), getExecutionPlanSnapshotKey());
+    }
     execute(*p);
 }
 
@@ -776,16 +1223,46 @@ void SwBuild::execute(ExecutionPlan &p) const
 
     p.build_always |= build_settings["build_always"] == "true";
     p.write_output_to_file |= build_settings["write_output_to_file"] == "true";
+    if (build_settings["critical_path_scheduling"] == "false")
+        p.critical_path_scheduling = false;
+    if (build_settings["link-jobs"])
+        p.budget.class_limits["link"] = std::stoi(build_settings["link-jobs"].getValue());
+    if (build_settings["build-memory"])
+        p.budget.memory = std::stoull(build_settings["build-memory"].getValue()) * 1024 * 1024;
     if (build_settings["skip_errors"].isValue())
         p.skip_errors = std::stoll(build_settings["skip_errors"].getValue());
     if (build_settings["time_limit"].isValue())
         p.setTimeLimit(parseTimeLimit(build_settings["time_limit"].getValue()));
+    if (remote_executor)
+    {
+        // local and remote slots are scheduled together
+        p.budget.remote = remote_executor->getNumberOfSlots();
+        if (!p.budget.cpu)
+            p.budget.cpu = (int)getBuildExecutor().numberOfThreads() - p.budget.remote;
+    }
+    // builds on the shared pool are admitted together,
+    // so concurrent builds do not run more than one machine of work
+    if (!build_executor)
+        p.admission = &getSharedAdmissionControl();
 
     ScopedTime t;
     p.execute(getBuildExecutor());
     if (build_settings["measure"] == "true")
         LOG_DEBUG(logger, BOOST_CURRENT_FUNCTION << " time: " << t.getTimeFloat() << " s.");
 
+    if (action_cache && (action_cache->hits || action_cache->stores))
+    {
+        LOG_INFO(logger, "Action cache: " << action_cache->hits << " hits (" << action_cache->remote_hits << " remote), "
+            << action_cache->misses << " misses, " << action_cache->stores << " stored");
+        if (action_cache->stores)
+            action_cache->trim();
+    }
+    if (remote_executor && (remote_executor->executed || remote_executor->failed))
+    {
+        LOG_INFO(logger, "Remote execution: " << remote_executor->executed << " commands, "
+            << remote_executor->failed << " were run locally after errors");
+    }
+
     if (build_settings["time_trace"] == "true")
         p.saveChromeTrace(getBuildDirectory() / "misc" / "time_trace.json");
 
@@ -1081,34 +1558,24 @@ std::unique_ptr<ExecutionPlan> SwBuild::getExecutionPlan(const Commands &cmds) c
 
     auto d = getBuildDirectory() / "misc";
 
-    auto [g, n, sc] = ep->getStrongComponents();
-
-    using Subgraph = boost::subgraph<ExecutionPlan::Graph>;
-
-    // fill copy of g
-    Subgraph root(g.m_vertices.size());
-    for (auto &e : g.m_edges)
-        boost::add_edge(e.m_source, e.m_target, root);
-
-    std::vector<Subgraph*> subs(n);
-    for (decltype(n) i = 0; i < n; i++)
-        subs[i] = &root.create_subgraph();
-    for (int i = 0; i < sc.size(); i++)
-        boost::add_vertex(i, *subs[sc[i]]);
+    auto cycles = ep->getCycles();
 
     auto cyclic_path = d / "cyclic";
     fs::create_directories(cyclic_path);
-    for (decltype(n) i = 0; i < n; i++)
-    {
-        if (subs[i]->m_graph.m_vertices.size() > 1)
-            ExecutionPlan::printGraph(subs[i]->m_graph, cyclic_path / ("cycle_" + std::to_string(i)));
-    }
+    for (size_t i = 0; i < cycles.size(); i++)
+        ExecutionPlan::printGraph(ExecutionPlan::getGraph(cycles[i]), cyclic_path / ("cycle_" + std::to_string(i)), cycles[i]);
 
     ep->printGraph(ep->getGraph(), cyclic_path / "processed", ep->getCommands(), true);
     ep->printGraph(ep->getGraphUnprocessed(), cyclic_path / "unprocessed", ep->getUnprocessedCommands(), true);
 
     String error = "Cannot create execution plan because of cyclic dependencies";
-    //String error = "Cannot create execution plan because of cyclic dependencies: strong components = " + std::to_string(n);
+    error += ": " + std::to_string(cycles.size()) + " cycle(s), see " + normalize_path(cyclic_path);
+    if (!cycles.empty())
+    {
+        error += "\nfirst cycle:";
+        for (auto &c : cycles[0])
+            error += "\n  " + c->getName();
+    }
 
     throw SW_RUNTIME_ERROR(error);
 }
@@ -1187,6 +1654,37 @@ path SwBuild::getExecutionPlanPath() const
     return getBuildDirectory() / "ep" / getName() += ext;
 }
 
+path SwBuild::getExecutionPlanSnapshotPath() const
+{
+    return getBuildDirectory() / "ep" / getName() += ".swbs";
+}
+
+String SwBuild::getExecutionPlanSnapshotKey() const
+{
+    // input hashes include their settings
+    return getHash() + "_" + build_settings.getHash();
+}
+
+bool SwBuild::runCachedExecutionPlan() const
+{
+    CHECK_STATE(BuildState::InputsLoaded);
+
+    auto sp = getExecutionPlanSnapshotPath();
+    auto key = getExecutionPlanSnapshotKey();
+    if (!fs::exists(getExecutionPlanPath()) || !ExecutionPlan::hasSnapshot(sp, key))
+        return false;
+
+    auto cmds = ExecutionPlan::load(getExecutionPlanPath(), *this);
+    auto p = ExecutionPlan::loadSnapshot(sp, key, cmds);
+    if (!p)
+        return false;
+    LOG_TRACE(logger, "using cached execution plan: " << normalize_path(sp));
+
+    overrideBuildState(BuildState::Prepared);
+    execute(*p);
+    return true;
+}
+
 void SwBuild::saveExecutionPlan() const
 {
     saveExecutionPlan(getExecutionPlanPath());
@@ -1232,17 +1730,46 @@ void SwBuild::setSettings(const TargetSettings &bs)
 {
     build_settings = bs;
 
-    if (build_settings["build-jobs"])
-        build_executor = std::make_unique<Executor>(std::stoi(build_settings["build-jobs"].getValue()));
+    sync_command_log = build_settings["sync_command_log"] == "true";
+    content_hash_check = build_settings["content_hash_check"] == "true";
+    early_cutoff = build_settings["early_cutoff"] == "true";
+    // remote cache needs local one, blobs are downloaded there
+    if (build_settings["action_cache"] == "true" || build_settings["action-cache-remote"])
+    {
+        uint64_t size = 10 * 1024; // MB
+        if (build_settings["action-cache-size"])
+            size = std::stoull(build_settings["action-cache-size"].getValue());
+        action_cache = std::make_unique<ActionCache>(getContext().getLocalStorage().storage_dir_tmp / "cache" / "actions", size * 1024 * 1024);
+        if (build_settings["action-cache-remote"])
+            action_cache->setRemote(build_settings["action-cache-remote"].getValue());
+    }
+    else
+        action_cache.reset();
+    if (build_settings["remote-workers"])
+        remote_executor = std::make_unique<RemoteExecutor>(build_settings["remote-workers"].getValue());
+    else
+        remote_executor.reset();
+    // private pool only when the shared one or its budget does not fit
+    build_executor.reset();
+    bool own_budget = build_settings["link-jobs"] || build_settings["build-memory"] || remote_executor;
+    if (build_settings["build-jobs"] || own_budget)
+    {
+        int jobs = build_settings["build-jobs"] ? std::stoi(build_settings["build-jobs"].getValue()) : (int)::getExecutor().numberOfThreads();
+        // threads of remote commands only wait for workers
+        if (remote_executor)
+            jobs += remote_executor->getNumberOfSlots();
+        if (own_budget || jobs != (int)getSharedBuildExecutor().numberOfThreads())
+            build_executor = std::make_unique<WorkStealingExecutor>(jobs);
+    }
     if (build_settings["prepare-jobs"])
         prepare_executor = std::make_unique<Executor>(std::stoi(build_settings["prepare-jobs"].getValue()));
 }
 
-Executor &SwBuild::getBuildExecutor() const
+CommandExecutor &SwBuild::getBuildExecutor() const
 {
     if (build_executor)
         return *build_executor;
-    return ::getExecutor();
+    return getSharedBuildExecutor();
 }
 
 Executor &SwBuild::getPrepareExecutor() const
@@ -25,6 +25,7 @@
 namespace sw
 {
 
+struct CommandExecutor;
 struct ExecutionPlan;
 struct Input;
 struct InputWithSettings;
@@ -79,6 +80,7 @@ struct SW_CORE_API SwBuild : SwBuilderContext
     void stop();
 
     // tune
+    // one prepare pass of all targets, prepare() does not wait for whole passes
     bool prepareStep();
     void execute(ExecutionPlan &p) const;
     std::unique_ptr<ExecutionPlan> getExecutionPlan(const Commands &cmds) const;
@@ -92,6 +94,7 @@ struct SW_CORE_API SwBuild : SwBuilderContext
     std::unique_ptr<ExecutionPlan> getExecutionPlan() const;
     String getHash() const;
     path getExecutionPlanPath() const;
+    path getExecutionPlanSnapshotPath() const;
 
     // tests
     void test();
@@ -124,7 +127,7 @@ private:
     TargetSettings build_settings;
     mutable BuildState state = BuildState::NotStarted;
     mutable Commands commands_storage; // we need some place to keep copy cmds
-    std::unique_ptr<Executor> build_executor;
+    std::unique_ptr<CommandExecutor> build_executor; // when shared one does not fit
     std::unique_ptr<Executor> prepare_executor;
     bool stopped = false;
     mutable ExecutionPlan *current_explan = nullptr;
@@ -136,8 +139,10 @@ private:
     Commands getCommands() const;
     void loadPackages(const TargetMap &predefined);
     void resolvePackages(const std::vector<IDependency*> &upkgs); // [2/2] step
-    Executor &getBuildExecutor() const;
+    CommandExecutor &getBuildExecutor() const;
     Executor &getPrepareExecutor() const;
+    String getExecutionPlanSnapshotKey() const;
+    bool runCachedExecutionPlan() const;
 };
 
 } // namespace sw
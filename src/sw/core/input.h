@@ -65,7 +65,8 @@ struct SW_CORE_API Input
 
     /// allow to load several inputs via driver
     virtual bool isBatchLoadable() const { return false; }
-    /// allow to throw input->load() into thread pool
+    /// allow to throw package loading into thread pool, also input->load() when input is not batch loadable
+    /// entry point must be safe to call concurrently for different settings
     virtual bool isParallelLoadable() const { return false; }
 
     bool isOutdated(const fs::file_time_type &) const;
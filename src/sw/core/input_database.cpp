@@ -20,6 +20,8 @@
 
 #include "specification.h"
 
+#include <sw/support/hash.h>
+
 #include <db_inputs.h>
 #include "inserts.h"
 #include <sqlpp11/sqlite3/connection.h>
@@ -54,7 +56,7 @@ size_t InputDatabase::getFileHash(const path &p) const
     }
 
     auto c = read_file(p);
-    auto h = std::hash<String>()(c);
+    auto h = hash64(c);
 
     std::vector<uint8_t> lwtdata(sizeof(lwt));
     memcpy(lwtdata.data(), &lwt, lwtdata.size());
@@ -0,0 +1,367 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "prepare.h"
+
+#include <nlohmann/json.hpp>
+
+#include <limits>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "prepare");
+
+namespace sw
+{
+
+PrepareScheduler::PrepareScheduler(const std::vector<ITarget *> &targets)
+{
+    std::unordered_map<const ITarget *, size_t> ids;
+    nodes.resize(targets.size());
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        nodes[i].target = targets[i];
+        ids[targets[i]] = i;
+    }
+
+    // direct deps, only targets that we prepare
+    std::vector<std::vector<size_t>> deps(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        for (auto d : nodes[i].target->getDependencies())
+        {
+            if (!d->isResolved())
+                continue;
+            auto it = ids.find(&d->getTarget());
+            if (it != ids.end() && it->second != i)
+                deps[i].push_back(it->second);
+        }
+    }
+
+    // strongly connected components (Tarjan's algorithm without recursion)
+    static constexpr size_t none = -1;
+    std::vector<size_t> index(nodes.size(), none);
+    std::vector<size_t> low(nodes.size());
+    std::vector<bool> on_stack(nodes.size());
+    std::vector<size_t> stack;
+    // node and its next dependency to visit
+    std::vector<std::pair<size_t, size_t>> calls;
+    size_t next_index = 0;
+    auto visit = [&](size_t v)
+    {
+        index[v] = low[v] = next_index++;
+        stack.push_back(v);
+        on_stack[v] = true;
+        calls.emplace_back(v, 0);
+    };
+    for (size_t root = 0; root < nodes.size(); root++)
+    {
+        if (index[root] != none)
+            continue;
+        visit(root);
+        while (!calls.empty())
+        {
+            auto [v, e] = calls.back();
+            if (e < deps[v].size())
+            {
+                calls.back().second++;
+                auto w = deps[v][e];
+                if (index[w] == none)
+                    visit(w);
+                else if (on_stack[w])
+                    low[v] = std::min(low[v], index[w]);
+                continue;
+            }
+            calls.pop_back();
+            if (!calls.empty())
+            {
+                auto u = calls.back().first;
+                low[u] = std::min(low[u], low[v]);
+            }
+            if (low[v] != index[v])
+                continue;
+            Component c;
+            size_t w;
+            do
+            {
+                w = stack.back();
+                stack.pop_back();
+                on_stack[w] = false;
+                nodes[w].component = components.size();
+                c.nodes.push_back(w);
+            } while (w != v);
+            components.push_back(std::move(c));
+        }
+    }
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        auto c = nodes[i].component;
+        for (auto d : deps[i])
+        {
+            auto cd = nodes[d].component;
+            if (cd == c)
+                continue;
+            components[c].deps.push_back(cd);
+            components[cd].dependents.push_back(c);
+        }
+    }
+    // several targets bring the same edge
+    for (auto &c : components)
+    {
+        std::sort(c.deps.begin(), c.deps.end());
+        c.deps.erase(std::unique(c.deps.begin(), c.deps.end()), c.deps.end());
+        std::sort(c.dependents.begin(), c.dependents.end());
+        c.dependents.erase(std::unique(c.dependents.begin(), c.dependents.end()), c.dependents.end());
+    }
+}
+
+void PrepareScheduler::run(Executor &e, const bool &stopped)
+{
+    executor = &e;
+    this->stopped = &stopped;
+
+    // first pass has no requirements
+    {
+        std::unique_lock lk(m);
+        for (size_t i = 0; i < nodes.size(); i++)
+            schedule(i);
+    }
+
+    // tasks add successors before they finish, so empty list means we are done
+    while (1)
+    {
+        Futures<void> fs;
+        {
+            std::unique_lock lk(m);
+            if (futures.empty())
+                break;
+            fs = std::move(futures);
+            futures.clear();
+        }
+        waitAndGet(fs);
+    }
+
+    if (eptr)
+        std::rethrow_exception(eptr);
+    if (stopped)
+        return;
+    for (auto &n : nodes)
+    {
+        if (!n.finished)
+            throw SW_LOGIC_ERROR("Target was not prepared: " + n.target->getPackage().toString());
+    }
+}
+
+// must be called under lock
+void PrepareScheduler::schedule(size_t i)
+{
+    if (eptr || *stopped)
+        return;
+    nodes[i].running = true;
+    futures.push_back(executor->push([this, i]
+    {
+        runPass(i);
+    }));
+}
+
+void PrepareScheduler::runPass(size_t i)
+{
+    auto &n = nodes[i];
+
+    PassTime t;
+    t.tid = std::this_thread::get_id();
+    t.begin = Clock::now();
+    bool next_pass = false;
+    std::exception_ptr ex;
+    try
+    {
+        next_pass = n.target->prepare();
+    }
+    catch (...)
+    {
+        ex = std::current_exception();
+    }
+    t.end = Clock::now();
+
+    std::unique_lock lk(m);
+    n.passes.push_back(t);
+    n.running = false;
+    if (ex)
+    {
+        if (!eptr)
+            eptr = ex;
+        return;
+    }
+    n.passes_done++;
+    n.finished = !next_pass;
+
+    // only targets of components with new least passes may start,
+    // this one included
+    std::vector<size_t> changed;
+    update(n.component, changed);
+    for (auto c : changed)
+    {
+        for (auto j : components[c].nodes)
+        {
+            if (canRun(j))
+                schedule(j);
+        }
+    }
+}
+
+// must be called under lock
+bool PrepareScheduler::canRun(size_t i) const
+{
+    auto &n = nodes[i];
+    if (n.running || n.finished)
+        return false;
+    auto &c = components[n.component];
+    return n.passes_done <= std::min(c.down, c.up);
+}
+
+// must be called under lock
+int PrepareScheduler::getPassesDone(const Component &c) const
+{
+    auto r = std::numeric_limits<int>::max();
+    for (auto i : c.nodes)
+    {
+        if (!nodes[i].finished)
+            r = std::min(r, nodes[i].passes_done);
+    }
+    return r;
+}
+
+// must be called under lock
+// after pass of target of the component is finished
+void PrepareScheduler::update(size_t component, std::vector<size_t> &changed)
+{
+    changed.push_back(component);
+
+    // least passes only grow, so we go further only from changed components
+    auto propagate = [this, component, &changed](int Component::*least, std::vector<size_t> Component::*from, std::vector<size_t> Component::*to)
+    {
+        std::vector<size_t> q{ component };
+        while (!q.empty())
+        {
+            auto i = q.back();
+            q.pop_back();
+            auto &c = components[i];
+            auto v = getPassesDone(c);
+            for (auto j : c.*from)
+                v = std::min(v, components[j].*least);
+            if (v == c.*least)
+                continue;
+            c.*least = v;
+            changed.push_back(i);
+            q.insert(q.end(), (c.*to).begin(), (c.*to).end());
+        }
+    };
+    // least pass of deps goes to dependents and vice versa
+    propagate(&Component::down, &Component::deps, &Component::dependents);
+    propagate(&Component::up, &Component::dependents, &Component::deps);
+}
+
+void PrepareScheduler::saveChromeTrace(const path &p) const
+{
+    auto min = Clock::time_point::max();
+    for (auto &n : nodes)
+    {
+        for (auto &t : n.passes)
+            min = std::min(t.begin, min);
+    }
+
+    auto tid_to_ll = [](auto &id)
+    {
+        std::ostringstream ss;
+        ss << id;
+        return ss.str();
+    };
+
+    nlohmann::json trace;
+    nlohmann::json events;
+    for (auto &n : nodes)
+    {
+        auto name = n.target->getPackage().toString();
+        auto cfg = n.target->getSettings().getHash();
+        for (size_t pass = 0; pass < n.passes.size(); pass++)
+        {
+            auto &t = n.passes[pass];
+
+            nlohmann::json b;
+            b["name"] = name + " pass " + std::to_string(pass + 1);
+            b["cat"] = "PREPARE";
+            b["pid"] = 1;
+            b["tid"] = tid_to_ll(t.tid);
+            b["ts"] = std::chrono::duration_cast<std::chrono::microseconds>(t.begin - min).count();
+            b["ph"] = "B";
+            b["args"]["config"] = cfg;
+            events.push_back(b);
+
+            nlohmann::json e;
+            e["name"] = b["name"];
+            e["cat"] = "PREPARE";
+            e["pid"] = 1;
+            e["tid"] = b["tid"];
+            e["ts"] = std::chrono::duration_cast<std::chrono::microseconds>(t.end - min).count();
+            e["ph"] = "E";
+            events.push_back(e);
+        }
+    }
+    trace["traceEvents"] = events;
+    write_file(p, trace.dump(2));
+}
+
+void PrepareScheduler::printStatistics() const
+{
+    struct PassStat
+    {
+        size_t n = 0;
+        double total = 0;
+        double max = 0;
+        const ITarget *slowest = nullptr;
+    };
+
+    std::vector<PassStat> stats;
+    for (auto &n : nodes)
+    {
+        if (stats.size() < n.passes.size())
+            stats.resize(n.passes.size());
+        for (size_t pass = 0; pass < n.passes.size(); pass++)
+        {
+            auto &t = n.passes[pass];
+            auto &s = stats[pass];
+            auto d = std::chrono::duration<double>(t.end - t.begin).count();
+            s.n++;
+            s.total += d;
+            if (d >= s.max)
+            {
+                s.max = d;
+                s.slowest = n.target;
+            }
+        }
+    }
+
+    for (size_t pass = 0; pass < stats.size(); pass++)
+    {
+        auto &s = stats[pass];
+        LOG_DEBUG(logger, "prepare pass " << pass + 1 << ": " << s.n << " targets, total time: " << s.total
+            << " s., slowest: " << s.slowest->getPackage().toString() << " (" << s.max << " s.)");
+    }
+}
+
+} // namespace sw
@@ -0,0 +1,103 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "target.h"
+
+#include <primitives/executor.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace sw
+{
+
+/// Runs multipass prepare of targets without global barriers between passes.
+///
+/// Pass N of a target starts when the target itself and all targets connected to it
+/// through dependencies (transitively, in both directions) have finished pass N - 1
+/// or all of their passes.
+/// So a target never runs concurrently with a later pass of its neighbours
+/// (as it was with step by step prepare), but unrelated parts of the graph
+/// do not wait for the slowest target on every pass.
+///
+/// Only direct edges are stored. Targets in dependency cycles form one component,
+/// and every component keeps the least pass of its transitive deps and dependents,
+/// which is updated along the edges when a pass finishes.
+struct PrepareScheduler
+{
+    using Clock = std::chrono::steady_clock;
+
+    PrepareScheduler(const std::vector<ITarget *> &targets);
+
+    /// run until all targets are prepared, an error occurs or stop is requested
+    void run(Executor &, const bool &stopped);
+
+    /// chrome://tracing compatible json with time of every pass of every target
+    void saveChromeTrace(const path &) const;
+    /// time per pass over all targets
+    void printStatistics() const;
+
+private:
+    struct PassTime
+    {
+        Clock::time_point begin;
+        Clock::time_point end;
+        std::thread::id tid;
+    };
+
+    struct Node
+    {
+        ITarget *target;
+        size_t component;
+        std::vector<PassTime> passes;
+        int passes_done = 0;
+        bool running = false;
+        bool finished = false;
+    };
+
+    // strongly connected component of dependency graph
+    struct Component
+    {
+        std::vector<size_t> nodes;
+        std::vector<size_t> deps;
+        std::vector<size_t> dependents;
+        // least passes done by unfinished targets of the component
+        // and of all its deps (down) or dependents (up)
+        int down = 0;
+        int up = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Component> components;
+    std::mutex m;
+    Futures<void> futures;
+    std::exception_ptr eptr;
+    Executor *executor = nullptr;
+    const bool *stopped = nullptr;
+
+    void schedule(size_t);
+    void runPass(size_t);
+    bool canRun(size_t) const;
+    int getPassesDone(const Component &) const;
+    void update(size_t component, std::vector<size_t> &changed);
+};
+
+} // namespace sw
@@ -25,9 +25,90 @@
 #include <nlohmann/json.hpp>
 #include <pystring.h>
 
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
 namespace sw
 {
 
+namespace
+{
+
+// comparison hashes are never stored, so they use fast in-memory mixing
+// and addresses of interned keys
+struct ComparisonHasher
+{
+    void add(uint64_t v)
+    {
+        h.low = mix(h.low ^ v);
+        h.high = mix(h.high + v * 0x9e3779b97f4a7c15ULL);
+    }
+
+    void add(const Hash128 &v)
+    {
+        add(v.low);
+        add(v.high);
+    }
+
+    Hash128 digest() const { return h; }
+
+private:
+    Hash128 h;
+
+    // murmur3 finalizer
+    static uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+};
+
+}
+
+InternedString::InternedString()
+{
+    static const InternedString empty(String{});
+    p = empty.p;
+}
+
+InternedString::InternedString(const String &s)
+{
+    // never freed, interned strings may be used by other static objects on exit
+    static auto &m = *new std::shared_mutex;
+    static auto &strings = *new std::unordered_map<std::string_view, std::unique_ptr<Data>>;
+
+    {
+        std::shared_lock lk(m);
+        auto i = strings.find(s);
+        if (i != strings.end())
+        {
+            p = i->second.get();
+            return;
+        }
+    }
+
+    auto d = std::make_unique<Data>();
+    d->s = s;
+    // same as TargetSetting::getHash1() for values
+    Hasher h;
+    h.add((uint64_t)1);
+    h.add(s);
+    d->value_hash = h.digest();
+
+    std::unique_lock lk(m);
+    // key points into d, so it is valid only if d is moved into the table
+    auto [i, inserted] = strings.try_emplace(d->s);
+    if (inserted)
+        i->second = std::move(d);
+    p = i->second.get();
+}
+
 TargetSettings toTargetSettings(const OS &o)
 {
     TargetSettings s;
@@ -139,9 +220,23 @@ TargetSetting &TargetSetting::operator=(const TargetSetting &rhs)
     }
     value = rhs.value;
     copy_fields(rhs);
+    changed();
     return *this;
 }
 
+void TargetSetting::changed()
+{
+    if (auto m = std::get_if<Map>(&value))
+        m->parent = this;
+    invalidateHash();
+}
+
+void TargetSetting::invalidateHash()
+{
+    if (parent)
+        parent->invalidateHash();
+}
+
 TargetSetting &TargetSetting::operator[](const TargetSettingKey &k)
 {
     if (value.index() == 0)
@@ -165,10 +260,10 @@ const TargetSetting &TargetSetting::operator[](const TargetSettingKey &k) const
 
 const String &TargetSetting::getValue() const
 {
-    auto v = std::get_if<Value>(&value);
+    auto v = std::get_if<InternedString>(&value);
     if (!v)
         throw SW_RUNTIME_ERROR("empty value");
-    return *v;
+    return v->str();
 }
 
 const TargetSetting::Array &TargetSetting::getArray() const
@@ -270,11 +365,13 @@ bool TargetSetting::operator<(const TargetSetting &rhs) const
 void TargetSetting::useInHash(bool b)
 {
     used_in_hash = b;
+    invalidateHash();
 }
 
 void TargetSetting::ignoreInComparison(bool b)
 {
     ignore_in_comparison = b;
+    invalidateHash();
 }
 
 // rename to serializable?
@@ -344,6 +441,7 @@ void TargetSetting::mergeFromJson(const nlohmann::json &j)
             s.mergeFromJson(e);
             v->push_back(s);
         }
+        invalidateHash();
         return;
     }
 
@@ -364,7 +462,7 @@ void TargetSetting::mergeFromJson(const nlohmann::json &j)
 
 bool TargetSetting::isValue() const
 {
-    return std::get_if<Value>(&value);
+    return std::get_if<InternedString>(&value);
 }
 
 bool TargetSetting::isArray() const
@@ -385,7 +483,8 @@ void TargetSetting::push_back(const ArrayValue &v)
             throw SW_RUNTIME_ERROR("key is not an array (null)");
         *this = Array();
     }
-    return std::get<Array>(value).push_back(v);
+    std::get<Array>(value).push_back(v);
+    invalidateHash();
 }
 
 void TargetSetting::reset()
@@ -400,11 +499,13 @@ void TargetSetting::use()
         use_count--;
     if (use_count == 0)
         reset();
+    invalidateHash();
 }
 
 void TargetSetting::setUseCount(int c)
 {
     use_count = c;
+    invalidateHash();
 }
 
 void TargetSetting::setRequired(bool b)
@@ -424,7 +525,7 @@ TargetSetting::operator bool() const
 
 String TargetSettings::getHash() const
 {
-    return shorten_hash(std::to_string(getHash1()), 6);
+    return shorten_hash(getHash1().toString(), 6);
 }
 
 void TargetSettings::mergeFromString(const String &s, int type)
@@ -495,84 +596,250 @@ nlohmann::json TargetSettings::toJson() const
     return j;
 }
 
-size_t TargetSetting::getHash1() const
+Hash128 TargetSetting::getHash1() const
+{
+    return getHashes().hash;
+}
+
+TargetSettings::Hashes TargetSetting::getHashes() const
 {
-    size_t h = 0;
+    TargetSettings::Hashes r;
+    // value type goes first, so "a" and ["a"] differ
+    Hasher h;
+    ComparisonHasher c;
+    h.add(value.index());
+    c.add(value.index());
     switch (value.index())
     {
     case 0:
-        return h;
+        return r;
     case 1:
-        return hash_combine(h, getValue());
+        r.hash = r.comparison_hash = std::get<InternedString>(value).p->value_hash;
+        return r;
     case 2:
         for (auto &v2 : std::get<Array>(value))
-            hash_combine(h, v2.getHash1());
-        break;
+        {
+            auto vh = v2.getHashes();
+            h.add(vh.hash);
+            r.has_consumed |= v2.use_count == 0 || vh.has_consumed;
+            // ignored element is equal to anything, but it keeps its position
+            if (v2.ignore_in_comparison)
+            {
+                r.has_ignored = true;
+                c.add(Hash128{ ~0ULL, ~0ULL });
+                continue;
+            }
+            c.add(vh.comparison_hash);
+            r.has_ignored |= vh.has_ignored;
+        }
+        r.comparison_hash = c.digest();
+        // empty arrays are not hashed, but they are compared
+        if (!std::get<Array>(value).empty())
+            r.hash = h.digest();
+        return r;
     case 3:
-        return hash_combine(h, std::get<Map>(value).getHash1());
+    {
+        r = std::get<Map>(value).getHashes();
+        h.add(r.hash);
+        c.add(r.comparison_hash);
+        break;
+    }
     case 4:
-        return hash_combine(h, h); // combine 0 and 0
+        break;
     default:
         SW_UNREACHABLE;
     }
-    return h;
+    r.hash = h.digest();
+    r.comparison_hash = c.digest();
+    return r;
+}
+
+TargetSettings::~TargetSettings() = default;
+
+TargetSettings::TargetSettings(const TargetSettings &rhs)
+{
+    operator=(rhs);
+}
+
+TargetSettings::TargetSettings(TargetSettings &&rhs) noexcept
+{
+    operator=(std::move(rhs));
+}
+
+TargetSettings &TargetSettings::operator=(const TargetSettings &rhs)
+{
+    if (this == &rhs)
+        return *this;
+    settings.clear();
+    settings.reserve(rhs.settings.size());
+    for (auto &p : rhs.settings)
+    {
+        settings.push_back(std::make_unique<value_type>(p->first, p->second));
+        settings.back()->second.parent = this;
+    }
+    invalidateHash();
+    if (rhs.hash_state.load(std::memory_order_acquire) == 2 && !rhs.hashes.has_consumed)
+    {
+        hashes = rhs.hashes;
+        hash_state = 2;
+    }
+    return *this;
 }
 
-size_t TargetSettings::getHash1() const
+TargetSettings &TargetSettings::operator=(TargetSettings &&rhs) noexcept
 {
-    size_t h = 0;
+    if (this == &rhs)
+        return *this;
+    settings = std::move(rhs.settings);
+    for (auto &p : settings)
+        p->second.parent = this;
+    invalidateHash();
+    if (rhs.hash_state.load(std::memory_order_acquire) == 2)
+    {
+        hashes = rhs.hashes;
+        hash_state = 2;
+    }
+    rhs.settings.clear();
+    rhs.invalidateHash();
+    return *this;
+}
+
+TargetSettings::Hashes TargetSettings::getHashes() const
+{
+    if (hash_state.load(std::memory_order_acquire) == 2)
+        return hashes;
+
+    Hashes r;
+    Hasher h;
+    ComparisonHasher c;
     for (auto &[k, v] : *this)
     {
-        if (!v.used_in_hash)
+        auto vh = v.getHashes();
+        r.has_consumed |= v.use_count == 0 || vh.has_consumed;
+        if (v.used_in_hash && vh.hash)
+        {
+            h.add(k);
+            h.add(vh.hash);
+        }
+        if (v.ignore_in_comparison)
+        {
+            r.has_ignored = true;
             continue;
-        auto h2 = v.getHash1();
-        if (h2 == 0)
+        }
+        if (v.isEmpty())
             continue;
-        hash_combine(h, k);
-        hash_combine(h, h2);
+        c.add((uint64_t)&k);
+        c.add(vh.comparison_hash);
+        r.has_ignored |= vh.has_ignored;
     }
-    return h;
+    r.hash = h.digest();
+    r.comparison_hash = c.digest();
+
+    // concurrent readers compute the same values, the first one stores them
+    int expected = 0;
+    if (hash_state.compare_exchange_strong(expected, 1))
+    {
+        hashes = r;
+        hash_state.store(2, std::memory_order_release);
+    }
+    return r;
+}
+
+Hash128 TargetSettings::getHash1() const
+{
+    return getHashes().hash;
+}
+
+std::optional<Hash128> TargetSettings::getComparisonHash() const
+{
+    auto h = getHashes();
+    if (h.has_ignored)
+        return {};
+    return h.comparison_hash;
+}
+
+void TargetSettings::invalidateHash()
+{
+    // parents are already invalid, if this one is
+    if (hash_state.load(std::memory_order_relaxed) == 0)
+        return;
+    hash_state = 0;
+    if (parent)
+        parent->invalidateHash();
+}
+
+TargetSettings::Storage::const_iterator TargetSettings::find(const TargetSettingKey &k) const
+{
+    auto i = std::lower_bound(settings.begin(), settings.end(), k, [](const auto &p, const auto &key)
+    {
+        return p->first < key;
+    });
+    if (i != settings.end() && (*i)->first == k)
+        return i;
+    return settings.end();
 }
 
 TargetSetting &TargetSettings::operator[](const TargetSettingKey &k)
 {
-    return settings.try_emplace(k, TargetSetting{}).first->second;
+    auto i = std::lower_bound(settings.begin(), settings.end(), k, [](const auto &p, const auto &key)
+    {
+        return p->first < key;
+    });
+    if (i != settings.end() && (*i)->first == k)
+        return (*i)->second;
+    invalidateHash();
+    InternedString key(k);
+    auto &v = (*settings.insert(i, std::make_unique<value_type>(key.str(), TargetSetting{})))->second;
+    v.parent = this;
+    return v;
 }
 
 const TargetSetting &TargetSettings::operator[](const TargetSettingKey &k) const
 {
-    auto i = settings.find(k);
+    auto i = find(k);
     if (i == settings.end())
     {
         thread_local TargetSetting s;
         return s;
     }
-    return i->second;
+    return (*i)->second;
 }
 
 bool TargetSettings::operator==(const TargetSettings &rhs) const
 {
-    for (auto &[k, v] : rhs.settings)
+    if (this == &rhs)
+        return true;
+
+    // hash covers everything that is compared below
+    auto h1 = getHashes();
+    auto h2 = rhs.getHashes();
+    if (h1.comparison_hash == h2.comparison_hash)
+        return true;
+    // ignored values are equal to anything, only then hashes may differ for equal settings
+    if (!h1.has_ignored && !h2.has_ignored)
+        return false;
+
+    for (auto &[k, v] : rhs)
     {
         if (v.ignoreInComparison())
             continue;
-        auto i = settings.find(k);
+        auto i = find(k);
         if (i == settings.end())
         {
             if (!v)
                 continue;
             return false;
         }
-        if (i->second != v)
+        if ((*i)->second != v)
             return false;
     }
 
     // check the rest of this settings
-    for (auto &[k, v] : settings)
+    for (auto &[k, v] : *this)
     {
         if (v.ignoreInComparison())
             continue;
-        auto i = rhs.settings.find(k);
+        auto i = rhs.find(k);
         if (i == rhs.settings.end())
         {
             if (!v)
@@ -585,12 +852,16 @@ bool TargetSettings::operator==(const TargetSettings &rhs) const
 
 bool TargetSettings::operator<(const TargetSettings &rhs) const
 {
-    return settings < rhs.settings;
+    return std::lexicographical_compare(begin(), end(), rhs.begin(), rhs.end());
 }
 
 bool TargetSettings::isSubsetOf(const TargetSettings &s) const
 {
-    for (auto &[k, v] : settings)
+    // equal settings
+    if (getHashes().comparison_hash == s.getHashes().comparison_hash)
+        return true;
+
+    for (auto &[k, v] : *this)
     {
         // value is missing -> ok
         if (!v)
@@ -599,12 +870,12 @@ bool TargetSettings::isSubsetOf(const TargetSettings &s) const
         if (v.ignoreInComparison())
             continue;
 
-        auto i = s.settings.find(k);
-        if (i == s.settings.end() || !i->second)
+        auto i = s.find(k);
+        if (i == s.settings.end() || !(*i)->second)
             return false;
 
         auto lv = std::get_if<TargetSettings>(&v.value);
-        auto rv = std::get_if<TargetSettings>(&i->second.value);
+        auto rv = std::get_if<TargetSettings>(&(*i)->second.value);
         if (lv && rv)
         {
             if (!lv->isSubsetOf(*rv))
@@ -612,7 +883,7 @@ bool TargetSettings::isSubsetOf(const TargetSettings &s) const
             continue;
         }
 
-        if (i->second != v)
+        if ((*i)->second != v)
             return false;
     }
     return true;
@@ -639,13 +910,13 @@ void TargetSettings::mergeFromJson(const nlohmann::json &j)
         if (pystring::endswith(it.key(), "_used_in_hash"))
         {
             if (it.value().get<String>() == "false")
-                (*this)[it.key().substr(0, it.key().size() - strlen("_used_in_hash"))].used_in_hash = false;
+                (*this)[it.key().substr(0, it.key().size() - strlen("_used_in_hash"))].useInHash(false);
             continue;
         }
         if (pystring::endswith(it.key(), "_ignore_in_comparison"))
         {
             if (it.value().get<String>() == "true")
-                (*this)[it.key().substr(0, it.key().size() - strlen("_ignore_in_comparison"))].ignore_in_comparison = true;
+                (*this)[it.key().substr(0, it.key().size() - strlen("_ignore_in_comparison"))].ignoreInComparison(true);
             continue;
         }
         (*this)[it.key()].mergeFromJson(it.value());
@@ -654,7 +925,10 @@ void TargetSettings::mergeFromJson(const nlohmann::json &j)
 
 void TargetSettings::erase(const TargetSettingKey &k)
 {
-    settings.erase(k);
+    invalidateHash();
+    auto i = find(k);
+    if (i != settings.end())
+        settings.erase(i);
 }
 
 bool TargetSettings::empty() const
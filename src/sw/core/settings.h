@@ -20,7 +20,9 @@
 
 #include <nlohmann/json_fwd.hpp>
 #include <primitives/filesystem.h>
+#include <sw/support/hash.h>
 
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <variant>
@@ -35,8 +37,67 @@ using TargetSettingValue = String;
 struct TargetSetting;
 struct TargetSettings;
 
+/// string stored once per process
+///
+/// Settings of thousands of targets repeat the same keys and values,
+/// so they are interned: equal strings have the same address and compare by pointer.
+/// Interned strings are never freed.
+struct SW_CORE_API InternedString
+{
+    InternedString();
+    InternedString(const String &);
+
+    const String &str() const { return p->s; }
+    operator const String &() const { return str(); }
+
+    bool operator==(const InternedString &rhs) const { return p == rhs.p; }
+    bool operator!=(const InternedString &rhs) const { return p != rhs.p; }
+    // by content, so ordering is stable between runs
+    bool operator<(const InternedString &rhs) const { return p != rhs.p && str() < rhs.str(); }
+
+private:
+    struct Data
+    {
+        String s;
+        // hash of the string as a setting value
+        Hash128 value_hash;
+    };
+
+    const Data *p;
+
+    friend struct TargetSetting;
+};
+
 struct SW_CORE_API TargetSettings
 {
+    using value_type = std::pair<const TargetSettingKey &, TargetSetting>;
+
+private:
+    using Storage = std::vector<std::unique_ptr<value_type>>;
+
+    template <class I, class V>
+    struct Iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = V;
+        using difference_type = std::ptrdiff_t;
+        using pointer = V *;
+        using reference = V &;
+
+        I i;
+
+        V &operator*() const { return **i; }
+        V *operator->() const { return i->get(); }
+        Iterator &operator++() { ++i; return *this; }
+        Iterator operator++(int) { return { i++ }; }
+        bool operator==(const Iterator &rhs) const { return i == rhs.i; }
+        bool operator!=(const Iterator &rhs) const { return i != rhs.i; }
+    };
+
+public:
+    using iterator = Iterator<Storage::iterator, value_type>;
+    using const_iterator = Iterator<Storage::const_iterator, const value_type>;
+
     enum StringType : int
     {
         KeyValue    = 0,
@@ -65,29 +126,77 @@ struct SW_CORE_API TargetSettings
     bool operator<(const TargetSettings &) const;
     bool isSubsetOf(const TargetSettings &) const;
 
-    auto begin() { return settings.begin(); }
-    auto end() { return settings.end(); }
-    auto begin() const { return settings.begin(); }
-    auto end() const { return settings.end(); }
+    /// equal settings have equal comparison hashes,
+    /// nothing is returned when values that ignore comparison make it impossible
+    std::optional<Hash128> getComparisonHash() const;
+
+    iterator begin() { return { settings.begin() }; }
+    iterator end() { return { settings.end() }; }
+    const_iterator begin() const { return { settings.begin() }; }
+    const_iterator end() const { return { settings.end() }; }
 
     bool empty() const;
 
+    TargetSettings() = default;
+    ~TargetSettings();
+    TargetSettings(const TargetSettings &);
+    TargetSettings(TargetSettings &&) noexcept;
+    TargetSettings &operator=(const TargetSettings &);
+    TargetSettings &operator=(TargetSettings &&) noexcept;
+
 private:
-    std::map<TargetSettingKey, TargetSetting> settings;
+    struct Hashes
+    {
+        // getHash1()
+        Hash128 hash;
+        // all values that take part in comparisons
+        Hash128 comparison_hash;
+        // something ignores comparison, so different comparison hashes
+        // do not mean different settings
+        bool has_ignored = false;
+        // consumed values are dropped on copy, so copies have other hashes
+        bool has_consumed = false;
+    };
+
+    // flat array sorted by key, values are allocated separately,
+    // so references stay valid on insertion like in std::map
+    Storage settings;
+    // computed on demand, any change of this or nested settings invalidates them
+    mutable Hashes hashes;
+    mutable std::atomic_int hash_state{ 0 };
+    // setting that holds this map, it is notified about changes
+    TargetSetting *parent = nullptr;
 
     //String toStringKeyValue() const;
     nlohmann::json toJson() const;
-    size_t getHash1() const;
+    Hash128 getHash1() const;
+    Hashes getHashes() const;
+    void invalidateHash();
+    Storage::const_iterator find(const TargetSettingKey &) const;
 
     friend struct TargetSetting;
 
 #ifdef BOOST_SERIALIZATION_ACCESS_HPP
     friend class boost::serialization::access;
+
+    // same archive as std::map had
+    template <class Ar>
+    void load(Ar &ar, unsigned)
+    {
+        std::map<TargetSettingKey, TargetSetting> m;
+        ar & m;
+        for (auto &[k, v] : m)
+            (*this)[k] = v;
+    }
     template <class Ar>
-    void serialize(Ar &ar, unsigned)
+    void save(Ar &ar, unsigned) const
     {
-        ar & settings;
+        std::map<TargetSettingKey, TargetSetting> m;
+        for (auto &[k, v] : *this)
+            m.emplace(k, v);
+        ar & m;
     }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 #endif
 };
 
@@ -129,9 +238,16 @@ struct SW_CORE_API TargetSetting
             setNull();
             return *this;
         }
-        reset();
-        value = u;
-        return *this;
+        else
+        {
+            reset();
+            if constexpr (std::is_convertible_v<U, String>)
+                value = InternedString(u);
+            else
+                value = u;
+            changed();
+            return *this;
+        }
     }
 
     bool operator==(const TargetSetting &) const;
@@ -141,10 +257,10 @@ struct SW_CORE_API TargetSetting
     template <class U>
     bool operator==(const U &u) const
     {
-        auto v = std::get_if<Value>(&value);
+        auto v = std::get_if<InternedString>(&value);
         if (!v)
             return false;
-        return *v == u;
+        return v->str() == u;
     }
 
     template <class U>
@@ -205,10 +321,16 @@ private:
     bool ignore_in_comparison = false;
     bool serializable_ = true;
     // when adding new member, add it to copy_fields()!
-    std::variant<std::monostate, Value, Array, Map, NullType> value;
+    std::variant<std::monostate, InternedString, Array, Map, NullType> value;
+    // map that holds this setting, not copied
+    TargetSettings *parent = nullptr;
 
     nlohmann::json toJson() const;
-    size_t getHash1() const;
+    // zero for empty values, they are not hashed
+    Hash128 getHash1() const;
+    TargetSettings::Hashes getHashes() const;
+    void invalidateHash();
+    void changed();
     void copy_fields(const TargetSetting &);
 
     friend struct TargetSettings;
@@ -232,7 +354,7 @@ private:
         {
             Value v;
             ar & v;
-            value = v;
+            value = InternedString(v);
         }
             break;
         case 2:
@@ -265,7 +387,7 @@ private:
         case 0:
             break;
         case 1:
-            ar & std::get<Value>(value);
+            ar & std::get<InternedString>(value).str();
             break;
         case 2:
             ar & std::get<Array>(value);
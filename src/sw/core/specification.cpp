@@ -38,7 +38,7 @@ Specification::Specification(const path &dir)
 size_t Specification::getHash(const InputDatabase &db) const
 {
     if (!dir.empty())
-        return std::hash<path>()(dir);
+        return hash64(dir.u8string());
 
     size_t h = 0;
     for (auto &[rel, f] : files.getData())
@@ -46,7 +46,7 @@ size_t Specification::getHash(const InputDatabase &db) const
         if (f.absolute_path.empty())
         {
             // for virtual files
-            hash_combine(h, std::hash<String>()(f.getContents()));
+            hash_combine(h, hash64(f.getContents()));
             continue;
         }
 
@@ -20,9 +20,62 @@
 
 #include "input.h"
 
+#include <algorithm>
+
 namespace sw
 {
 
+// small containers are faster to scan
+static const size_t index_min_targets = 8;
+
+// often queried settings, targets are bucketed by their values
+static const size_t n_discrimination_keys = 4;
+static const std::pair<const char *, const char *> discrimination_keys[n_discrimination_keys] =
+{
+    { "os", "kernel" },
+    { "os", "arch" },
+    { "native", "library" },
+    { "native", "configuration" },
+};
+
+// interned value of the target setting, nullptr if target accepts any value
+static const String *get_target_value(const TargetSettings &s, size_t k)
+{
+    auto &v1 = s[discrimination_keys[k].first];
+    if (!v1.isObject() || v1.ignoreInComparison())
+        return nullptr;
+    auto &v2 = v1[discrimination_keys[k].second];
+    if (!v2.isValue() || v2.ignoreInComparison())
+        return nullptr;
+    return &v2.getValue();
+}
+
+// returns false when query matches any target value,
+// otherwise r is the query value or nullptr if only targets without value match
+static bool get_query_value(const TargetSettings &s, size_t k, const String *&r)
+{
+    r = nullptr;
+    auto &v1 = s[discrimination_keys[k].first];
+    if (v1.ignoreInComparison())
+        return false;
+    if (!v1.isObject())
+        return true;
+    auto &v2 = v1[discrimination_keys[k].second];
+    if (v2.ignoreInComparison())
+        return false;
+    if (v2.isValue())
+        r = &v2.getValue();
+    return true;
+}
+
+static size_t get_suitable_key(const String *const *values)
+{
+    size_t h = 0;
+    for (size_t k = 0; k < n_discrimination_keys; k++)
+        hash_combine(h, values[k]);
+    return h;
+}
+
 IDependency::~IDependency() = default;
 ITarget::~ITarget() = default;
 TargetEntryPoint::~TargetEntryPoint() = default;
@@ -45,6 +98,7 @@ TargetContainer &TargetContainer::operator=(const TargetContainer &rhs)
     if (this == &rhs)
         return *this;
     targets = rhs.targets;
+    index = rhs.index;
     if (rhs.input)
         input = std::make_unique<BuildInput>(rhs.getInput());
     return *this;
@@ -58,50 +112,179 @@ void TargetContainer::push_back(const ITargetPtr &t)
 {
     // on the same settings, we take input target and overwrite old one
 
-    auto i = findEqual(t->getSettings());
-    if (i == end())
+    auto i = findEqual1(t->getSettings());
+    if (!i)
     {
         targets.push_back(t);
+        index.add(targets.size() - 1, t->getSettings());
         return;
     }
-    *i = t;
+    // equal settings may still differ in values that ignore comparison
+    index.remove(*i);
+    targets[*i] = t;
+    index.add(*i, t->getSettings());
 }
 
 void TargetContainer::clear()
 {
     targets.clear();
+    index.clear();
 }
 
-TargetContainer::Base::iterator TargetContainer::findEqual(const TargetSettings &s)
+void TargetContainer::rebuildIndex()
 {
-    return std::find_if(begin(), end(), [&s](const auto &t)
+    index.clear();
+    for (size_t i = 0; i < targets.size(); i++)
+        index.add(i, targets[i]->getSettings());
+}
+
+void TargetContainer::Index::add(size_t pos, const TargetSettings &s)
+{
+    Keys k;
+    if (auto h = s.getComparisonHash())
     {
-        return t->getSettings() == s;
-    });
+        k.equal = h->get64();
+        equal[k.equal].push_back(pos);
+    }
+    else
+        unhashed.push_back(pos);
+
+    const String *values[n_discrimination_keys];
+    for (size_t i = 0; i < n_discrimination_keys; i++)
+        values[i] = get_target_value(s, i);
+    k.suitable = get_suitable_key(values);
+    suitable[k.suitable].push_back(pos);
+
+    if (keys.size() <= pos)
+        keys.resize(pos + 1);
+    keys[pos] = k;
 }
 
-TargetContainer::Base::const_iterator TargetContainer::findEqual(const TargetSettings &s) const
+void TargetContainer::Index::remove(size_t pos)
 {
-    return std::find_if(begin(), end(), [&s](const auto &t)
+    auto erase = [pos](auto &v)
     {
-        return t->getSettings() == s;
-    });
+        v.erase(std::remove(v.begin(), v.end(), pos), v.end());
+    };
+
+    auto &k = keys[pos];
+    if (k.equal)
+        erase(equal[k.equal]);
+    else
+        erase(unhashed);
+    erase(suitable[k.suitable]);
 }
 
-TargetContainer::Base::iterator TargetContainer::findSuitable(const TargetSettings &s)
+void TargetContainer::Index::clear()
+{
+    equal.clear();
+    suitable.clear();
+    unhashed.clear();
+    keys.clear();
+}
+
+std::optional<size_t> TargetContainer::findEqual1(const TargetSettings &s) const
 {
-    return std::find_if(begin(), end(), [&s](const auto &t)
+    auto linear = [this, &s]() -> std::optional<size_t>
     {
-        return t->getSettings().isSubsetOf(s);
-    });
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            if (targets[i]->getSettings() == s)
+                return i;
+        }
+        return {};
+    };
+
+    if (targets.size() < index_min_targets)
+        return linear();
+    auto h = s.getComparisonHash();
+    if (!h)
+        return linear();
+
+    std::vector<size_t> candidates = index.unhashed;
+    if (auto i = index.equal.find(h->get64()); i != index.equal.end())
+        candidates.insert(candidates.end(), i->second.begin(), i->second.end());
+    // first target wins like in the plain scan
+    std::sort(candidates.begin(), candidates.end());
+    for (auto i : candidates)
+    {
+        if (targets[i]->getSettings() == s)
+            return i;
+    }
+    return {};
 }
 
-TargetContainer::Base::const_iterator TargetContainer::findSuitable(const TargetSettings &s) const
+std::optional<size_t> TargetContainer::findSuitable1(const TargetSettings &s) const
 {
-    return std::find_if(begin(), end(), [&s](const auto &t)
+    auto linear = [this, &s]() -> std::optional<size_t>
+    {
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            if (targets[i]->getSettings().isSubsetOf(s))
+                return i;
+        }
+        return {};
+    };
+
+    if (targets.size() < index_min_targets)
+        return linear();
+
+    const String *query[n_discrimination_keys];
+    for (size_t k = 0; k < n_discrimination_keys; k++)
     {
-        return t->getSettings().isSubsetOf(s);
-    });
+        if (!get_query_value(s, k, query[k]))
+            return linear();
+    }
+
+    // targets either have the query value or accept any value for every key,
+    // so we look into buckets of all such combinations
+    std::vector<size_t> candidates;
+    for (size_t mask = 0; mask < (1 << n_discrimination_keys); mask++)
+    {
+        const String *values[n_discrimination_keys];
+        bool skip = false;
+        for (size_t k = 0; k < n_discrimination_keys; k++)
+        {
+            values[k] = (mask & (1 << k)) ? nullptr : query[k];
+            // query without value is tried once
+            skip |= (mask & (1 << k)) && !query[k];
+        }
+        if (skip)
+            continue;
+        if (auto i = index.suitable.find(get_suitable_key(values)); i != index.suitable.end())
+            candidates.insert(candidates.end(), i->second.begin(), i->second.end());
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (auto i : candidates)
+    {
+        if (targets[i]->getSettings().isSubsetOf(s))
+            return i;
+    }
+    return {};
+}
+
+TargetContainer::Base::iterator TargetContainer::findEqual(const TargetSettings &s)
+{
+    auto i = findEqual1(s);
+    return i ? begin() + *i : end();
+}
+
+TargetContainer::Base::const_iterator TargetContainer::findEqual(const TargetSettings &s) const
+{
+    auto i = findEqual1(s);
+    return i ? begin() + *i : end();
+}
+
+TargetContainer::Base::iterator TargetContainer::findSuitable(const TargetSettings &s)
+{
+    auto i = findSuitable1(s);
+    return i ? begin() + *i : end();
+}
+
+TargetContainer::Base::const_iterator TargetContainer::findSuitable(const TargetSettings &s) const
+{
+    auto i = findSuitable1(s);
+    return i ? begin() + *i : end();
 }
 
 bool TargetContainer::empty() const
@@ -111,7 +294,10 @@ bool TargetContainer::empty() const
 
 TargetContainer::Base::iterator TargetContainer::erase(Base::iterator begin, Base::iterator end)
 {
-    return targets.erase(begin, end);
+    auto i = targets.erase(begin, end);
+    // positions have changed
+    rebuildIndex();
+    return i;
 }
 
 const BuildInput &TargetContainer::getInput() const
@@ -201,6 +387,29 @@ PredefinedTarget::~PredefinedTarget()
 {
 }
 
+Commands PreparedTarget::getDependenciesGeneratedCommands(const ITarget &t)
+{
+    Commands cmds;
+    std::unordered_set<const ITarget *> visited;
+    std::function<void(const ITarget &)> add;
+    add = [&cmds, &visited, &add](const ITarget &t)
+    {
+        for (auto d : t.getDependencies())
+        {
+            if (!d->isResolved())
+                continue;
+            auto &dt = d->getTarget();
+            if (!visited.insert(&dt).second)
+                continue;
+            auto g = dt.getGeneratedCommands();
+            cmds.insert(g.begin(), g.end());
+            add(dt);
+        }
+    };
+    add(t);
+    return cmds;
+}
+
 struct PredefinedDependency : IDependency
 {
     PredefinedDependency(const PackageId &unresolved_pkg, const TargetSettings &ts) : unresolved_pkg(unresolved_pkg), ts(ts) {}
@@ -27,6 +27,7 @@
 #include <sw/support/source.h>
 
 #include <any>
+#include <unordered_map>
 #include <variant>
 
 namespace sw
@@ -96,6 +97,10 @@ struct SW_CORE_API ITarget : ICastable
     // get using settings?
     virtual Commands getTests() const = 0;
 
+    // get commands generating files used by dependents (e.g. headers)
+    // commands of dependents run after them
+    virtual Commands getGeneratedCommands() const { return {}; }
+
     //
     // extended info section
     // configuration specific
@@ -172,6 +177,34 @@ private:
     mutable std::vector<IDependencyPtr> deps;
 };
 
+// this target will be created by core
+// when prepared state of unchanged local target is loaded from the previous build
+// dependents see it as predefined target
+struct SW_CORE_API PreparedTarget : PredefinedTarget
+{
+    Commands commands;
+    Commands generated_commands;
+    Commands tests;
+    // edges from own commands to generated commands of deps recorded by command hashes,
+    // they are restored after deps are prepared
+    std::vector<std::pair<size_t, size_t>> deps_generated_edges;
+    // build objects may still refer to it
+    ITargetPtr loaded;
+
+    using PredefinedTarget::PredefinedTarget;
+
+    Commands getCommands() const override { return commands; }
+    Commands getTests() const override { return tests; }
+    Commands getGeneratedCommands() const override { return generated_commands; }
+
+    // generated commands of all resolved deps, recursively
+    static Commands getDependenciesGeneratedCommands(const ITarget &);
+};
+
+/// targets of one package version, one per settings
+///
+/// Targets are indexed by their settings, so lookups do not compare settings of every target.
+/// Targets must be added and replaced with push_back(), not through iterators.
 struct SW_CORE_API TargetContainer
 {
     using Base = std::vector<ITargetPtr>;
@@ -211,8 +244,36 @@ struct SW_CORE_API TargetContainer
     std::vector<ITargetPtr> loadPackages(SwBuild &, const TargetSettings &, const PackageIdSet &allowed_packages) const;
 
 private:
+    struct Index
+    {
+        struct Keys
+        {
+            // zero when settings have values that ignore comparison
+            size_t equal = 0;
+            size_t suitable = 0;
+        };
+
+        // comparison hash -> positions
+        std::unordered_map<size_t, std::vector<size_t>> equal;
+        // values of often queried settings -> positions
+        std::unordered_map<size_t, std::vector<size_t>> suitable;
+        // positions of targets that findEqual() always checks
+        std::vector<size_t> unhashed;
+        // per position
+        std::vector<Keys> keys;
+
+        void add(size_t pos, const TargetSettings &);
+        void remove(size_t pos);
+        void clear();
+    };
+
     std::unique_ptr<BuildInput> input;
     std::vector<ITargetPtr> targets;
+    Index index;
+
+    std::optional<size_t> findEqual1(const TargetSettings &) const;
+    std::optional<size_t> findSuitable1(const TargetSettings &) const;
+    void rebuildIndex();
 };
 
 namespace detail
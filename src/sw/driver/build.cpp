@@ -53,6 +53,13 @@ DECLARE_STATIC_LOGGER(logger, "build");
 namespace sw
 {
 
+DriverData::DriverData(const DriverData &rhs)
+    : source_dirs_by_source(rhs.source_dirs_by_source)
+    , source_dirs_by_package(rhs.source_dirs_by_package)
+    , force_source(rhs.force_source ? rhs.force_source->clone() : nullptr)
+{
+}
+
 Build::Build(SwBuild &mb)
     : checker(mb)
 {
@@ -46,6 +46,9 @@ struct DriverData
     SourceDirMap source_dirs_by_source;
     std::unordered_map<PackageId, path> source_dirs_by_package;
     SourcePtr force_source;
+
+    DriverData() = default;
+    DriverData(const DriverData &);
 };
 
 struct SW_DRIVER_CPP_API Test : driver::CommandBuilder
@@ -74,7 +77,7 @@ struct SW_DRIVER_CPP_API Build : SimpleBuild
     using Base = SimpleBuild;
 
     ModuleSwappableData module_data;
-    DriverData *dd = nullptr;
+    std::shared_ptr<const DriverData> dd;
     Checker checker;
 
     //
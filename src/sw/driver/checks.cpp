@@ -264,6 +264,12 @@ void CheckSet::performChecks(const SwBuild &mb, const TargetSettings &ts)
 {
     static const auto checks_dir = checker.swbld.getContext().getLocalStorage().storage_dir_etc / "sw" / "checks";
 
+    // packages are loaded with different settings in parallel,
+    // but checks storages and tmp checks dir are shared, so we perform one check set at a time
+    // (recursive, because we may enter again after manual checks)
+    static std::recursive_mutex perform_mutex;
+    std::unique_lock perform_lk(perform_mutex);
+
     //std::unique_lock lk(m);
 
     auto config = ts.getHash();
@@ -401,7 +407,7 @@ int main() { return IsBigEndian(); }
         };
 
         //auto &e = getExecutor();
-        static Executor e(mb.getSettings()["checks_single_thread"] == "true" ? 1 : getExecutor().numberOfThreads()); // separate executor!
+        static WorkStealingExecutor e(mb.getSettings()["checks_single_thread"] == "true" ? 1 : getExecutor().numberOfThreads()); // separate executor!
 
         try
         {
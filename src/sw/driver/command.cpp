@@ -296,6 +296,14 @@ std::shared_ptr<Command> GNUCommand::clone() const
     return std::make_shared<GNUCommand>(*this);
 }
 
+Files GNUCommand::getRemoteOutputs() const
+{
+    auto o = Base::getRemoteOutputs();
+    if (!deps_file.empty())
+        o.insert(deps_file);
+    return o;
+}
+
 void GNUCommand::postProcess1(bool ok)
 {
     // deps are placed into separate file, so we can skip our jobs
@@ -403,6 +403,7 @@ struct SW_DRIVER_CPP_API GNUCommand : Command
 
 private:
     void postProcess1(bool ok) override;
+    Files getRemoteOutputs() const override;
 
 #ifdef BOOST_SERIALIZATION_ACCESS_HPP
     friend class boost::serialization::access;
@@ -176,8 +176,8 @@ struct SpecFileInput : Input, DriverInput
             ;
     }
 
-    // everything else is parallel loadable
-    bool isParallelLoadable() const override { return !isBatchLoadable(); }
+    // batch loadable inputs are loaded together, but their packages are loaded in parallel too
+    bool isParallelLoadable() const override { return true; }
 
     EntryPointPtr load1(SwContext &swctx) override
     {
@@ -291,18 +291,27 @@ Build NativeTargetEntryPoint::createBuild(SwBuild &swb, const TargetSettings &s,
     // we need to fix some settings before they go to targets
     auto settings = s;
 
-    if (!dd)
-        dd = std::make_unique<DriverData>();
+    // we are called concurrently for different settings,
+    // so every build gets its own copy of driver data
+    std::shared_ptr<const DriverData> dd2;
+    {
+        std::unique_lock lk(m);
+
+        if (!dd)
+            dd = std::make_unique<DriverData>();
 
-    for (auto &[h, d] : settings["driver"]["source-dir-for-source"].getMap())
-        dd->source_dirs_by_source[h].requested_dir = d.getValue();
-    for (auto &[pkg, p] : settings["driver"]["source-dir-for-package"].getMap())
-        dd->source_dirs_by_package[pkg] = p.getValue();
-    if (settings["driver"]["force-source"].isValue())
-        dd->force_source = load(nlohmann::json::parse(settings["driver"]["force-source"].getValue()));
+        for (auto &[h, d] : settings["driver"]["source-dir-for-source"].getMap())
+            dd->source_dirs_by_source[h].requested_dir = d.getValue();
+        for (auto &[pkg, p] : settings["driver"]["source-dir-for-package"].getMap())
+            dd->source_dirs_by_package[pkg] = p.getValue();
+        if (settings["driver"]["force-source"].isValue())
+            dd->force_source = load(nlohmann::json::parse(settings["driver"]["force-source"].getValue()));
+
+        dd2 = std::make_shared<DriverData>(*dd);
+    }
 
     Build b(swb);
-    b.dd = dd.get();
+    b.dd = dd2;
     // leave as b. setting
     b.DryRun = settings["driver"]["dry-run"] == "true";
 
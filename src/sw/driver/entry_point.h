@@ -21,6 +21,8 @@
 #include "build_settings.h"
 #include "module.h"
 
+#include <mutex>
+
 namespace sw
 {
 
@@ -38,6 +40,7 @@ struct NativeTargetEntryPoint : TargetEntryPoint
 {
     path source_dir;
     mutable std::unique_ptr<DriverData> dd;
+    mutable std::mutex m;
 
     [[nodiscard]]
     std::vector<ITargetPtr> loadPackages(SwBuild &, const TargetSettings &, const PackageIdSet &pkgs, const PackagePath &prefix) const override;
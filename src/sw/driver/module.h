@@ -39,7 +39,6 @@ struct SW_DRIVER_CPP_API Module
         using std_function_type = std::function<F>;
 
         String name;
-        const Build *s = nullptr;
         const Module *m = nullptr;
         std_function_type f;
 
@@ -67,10 +66,11 @@ private:
     std::unique_ptr<Module::DynamicLibrary> module;
     bool do_not_remove_bad_module;
 
-    mutable LibraryCall<void(Build &), true> build_;
-    mutable LibraryCall<void(Build &)> configure_;
-    mutable LibraryCall<void(Checker &)> check_;
-    mutable LibraryCall<int(), true> sw_get_module_abi_version_;
+    // set once on load, so module is safe to call from several threads
+    LibraryCall<void(Build &), true> build_;
+    LibraryCall<void(Build &)> configure_;
+    LibraryCall<void(Checker &)> check_;
+    LibraryCall<int(), true> sw_get_module_abi_version_;
 
     path getLocation() const;
 };
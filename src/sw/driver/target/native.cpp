@@ -1382,6 +1382,8 @@ Commands NativeCompiledTarget::getCommands1() const
         auto prepare_command = [this, &cmds, &sd, &bd, &bdp](auto f, auto c)
         {
             c->arguments.push_back(f->args);
+            c->cacheable = true;
+            c->resources.remote = true;
 
             // set fancy name
             if (!IsSwConfig && !(getMainBuild().getSettings()["do_not_mangle_object_names"] == "true"))
@@ -1479,6 +1481,9 @@ Commands NativeCompiledTarget::getCommands1() const
     if (auto c = getCommand())
     {
         c->dependencies.insert(cmds.begin(), cmds.end());
+        c->cacheable = true;
+        if (!isStaticLibrary())
+            c->resources.resource_class = "link"; // limited by 'link-jobs'
 
         File d(def, getFs());
         if (d.isGenerated())
@@ -1508,16 +1513,13 @@ Commands NativeCompiledTarget::getCommands1() const
         // add dependencies on generated commands from dependent targets
         for (auto &l : get_tgts())
         {
-            if (auto nt = l->as<NativeCompiledTarget*>())
+            // for idir deps generated commands won't be used!
+            auto cmds2 = l->getGeneratedCommands();
+            for (auto &c : cmds)
             {
-                // for idir deps generated commands won't be used!
-                auto cmds2 = nt->getGeneratedCommands();
-                for (auto &c : cmds)
-                {
-                    if (auto c2 = c->as<driver::detail::Command*>(); c2 && c2->ignore_deps_generated_commands)
-                        continue;
-                    c->dependencies.insert(cmds2.begin(), cmds2.end());
-                }
+                if (auto c2 = c->as<driver::detail::Command*>(); c2 && c2->ignore_deps_generated_commands)
+                    continue;
+                c->dependencies.insert(cmds2.begin(), cmds2.end());
             }
         }
 
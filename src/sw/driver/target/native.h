@@ -204,7 +204,7 @@ protected:
     Commands getCommands1() const override;
 
 private:
-    Commands getGeneratedCommands() const;
+    Commands getGeneratedCommands() const override;
     void resolvePostponedSourceFiles();
     FilesOrdered gatherRpathLinkDirectories() const;
     FilesOrdered gatherLinkDirectories() const;
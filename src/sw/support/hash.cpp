@@ -6,6 +6,8 @@
 
 #include "hash.h"
 
+#include <xxhash.h>
+
 String get_file_hash(const path &fn)
 {
     return strong_file_hash(fn);
@@ -15,3 +17,58 @@ bool check_file_hash(const path &fn, const String &hash)
 {
     return hash == get_file_hash(fn);
 }
+
+namespace sw
+{
+
+String Hash128::toString() const
+{
+    static const char hex[] = "0123456789abcdef";
+    String s(32, '0');
+    for (int i = 0; i < 16; i++)
+    {
+        s[15 - i] = hex[(high >> (i * 4)) & 0xf];
+        s[31 - i] = hex[(low >> (i * 4)) & 0xf];
+    }
+    return s;
+}
+
+Hash128 hash128(const void *data, size_t size)
+{
+    auto h = XXH3_128bits(data, size);
+    return { h.low64, h.high64 };
+}
+
+uint64_t hash64(std::string_view s)
+{
+    auto h = XXH3_64bits(s.data(), s.size());
+    return h ? h : 1;
+}
+
+void Hasher::add(std::string_view s)
+{
+    add((uint64_t)s.size());
+    data.append(s.data(), s.size());
+}
+
+void Hasher::add(uint64_t v)
+{
+    // little endian on every platform
+    char b[8];
+    for (int i = 0; i < 8; i++)
+        b[i] = (char)(v >> (i * 8));
+    data.append(b, sizeof(b));
+}
+
+void Hasher::add(const Hash128 &h)
+{
+    add(h.low);
+    add(h.high);
+}
+
+Hash128 Hasher::digest() const
+{
+    return hash128(data.data(), data.size());
+}
+
+}
@@ -9,8 +9,63 @@
 #include <primitives/hash.h>
 #include <primitives/hash_combine.h>
 
+#include <string_view>
+#include <tuple>
+
 SW_SUPPORT_API
 String get_file_hash(const path &fn);
 
 SW_SUPPORT_API
 bool check_file_hash(const path &fn, const String &hash);
+
+namespace sw
+{
+
+/// xxh3 128-bit hash
+///
+/// Unlike std::hash, it is the same on every platform and standard library,
+/// so it can be stored on disk.
+struct SW_SUPPORT_API Hash128
+{
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    /// for in-memory maps and 64-bit keys, never 0
+    size_t get64() const { return low ? low : 1; }
+    /// 32 hex chars
+    String toString() const;
+
+    explicit operator bool() const { return low || high; }
+    bool operator==(const Hash128 &rhs) const { return low == rhs.low && high == rhs.high; }
+    bool operator!=(const Hash128 &rhs) const { return !operator==(rhs); }
+    bool operator<(const Hash128 &rhs) const { return std::tie(high, low) < std::tie(rhs.high, rhs.low); }
+};
+
+SW_SUPPORT_API
+Hash128 hash128(const void *data, size_t size);
+
+inline Hash128 hash128(std::string_view s)
+{
+    return hash128(s.data(), s.size());
+}
+
+/// xxh3 64-bit hash, never 0
+SW_SUPPORT_API
+uint64_t hash64(std::string_view s);
+
+/// hash of several values
+///
+/// Strings are length prefixed, so ("ab", "c") and ("a", "bc") differ.
+struct SW_SUPPORT_API Hasher
+{
+    void add(std::string_view);
+    void add(uint64_t);
+    void add(const Hash128 &);
+
+    Hash128 digest() const;
+
+private:
+    String data;
+};
+
+}
@@ -0,0 +1,142 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// standalone ActionCacheService backed by a local directory
+//
+// usage: action_cache_server [-listen host:port] [-root dir] [-max-size MB]
+
+#include <sw/builder/remote_action_cache.h>
+
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+#include <primitives/sw/settings_program_name.h>
+
+#include <mutex>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "action_cache_server");
+
+#define TRIM_EVERY_N_UPDATES 1000
+
+using namespace sw;
+
+struct ActionCacheServiceImpl final : api::build::ActionCacheService::Service
+{
+    ActionCacheServiceImpl(ActionCache &ac) : ac(ac) {}
+
+    grpc::Status GetActionResult(grpc::ServerContext *, const api::build::GetActionResultRequest *request,
+        api::build::ActionResult *response) override
+    {
+        return wrap([&]()
+        {
+            auto a = ac.findLocal(fromProto(request->action_key()));
+            if (!a)
+                return grpc::Status(grpc::StatusCode::NOT_FOUND, "no action result");
+            toProto(*a, *response);
+            return grpc::Status::OK;
+        });
+    }
+
+    grpc::Status UpdateActionResult(grpc::ServerContext *, const api::build::UpdateActionResultRequest *request,
+        google::protobuf::Empty *) override
+    {
+        return wrap([&]()
+        {
+            auto a = fromProto(request->result());
+            for (auto &o : a.outputs)
+            {
+                if (!ac.hasBlob(o.hash))
+                    return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "missing blob " + o.hash.toString());
+            }
+            ac.storeAction(fromProto(request->action_key()), a);
+            if (++updates % TRIM_EVERY_N_UPDATES == 0)
+                trim();
+            return grpc::Status::OK;
+        });
+    }
+
+    grpc::Status FindMissingBlobs(grpc::ServerContext *, const api::build::FindMissingBlobsRequest *request,
+        api::build::FindMissingBlobsResponse *response) override
+    {
+        return wrap([&]() { return serveFindMissingBlobs(ac, *request, *response); });
+    }
+
+    grpc::Status ReadBlob(grpc::ServerContext *, const api::build::ReadBlobRequest *request,
+        grpc::ServerWriter<api::build::BlobChunk> *writer) override
+    {
+        return wrap([&]() { return serveReadBlob(ac, *request, *writer); });
+    }
+
+    grpc::Status WriteBlob(grpc::ServerContext *, grpc::ServerReader<api::build::BlobChunk> *reader,
+        google::protobuf::Empty *) override
+    {
+        return wrap([&]() { return serveWriteBlob(ac, *reader); });
+    }
+
+    void trim()
+    {
+        std::unique_lock lk(trim_mutex, std::try_to_lock);
+        if (lk.owns_lock())
+            ac.trim();
+    }
+
+private:
+    ActionCache &ac;
+    std::atomic_size_t updates = 0;
+    std::mutex trim_mutex;
+
+    template <class F>
+    static grpc::Status wrap(F &&f)
+    {
+        try
+        {
+            return f();
+        }
+        catch (std::exception &e)
+        {
+            LOG_ERROR(logger, e.what());
+            return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    static cl::opt<String> listen("listen", cl::desc("Address to listen on"), cl::init("localhost:50051"));
+    static cl::opt<path> root("root", cl::desc("Cache directory"), cl::init("action_cache"));
+    static cl::opt<uint64_t> max_size("max-size", cl::desc("Max cache size (MB)"), cl::init(100 * 1024));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    ActionCache ac(fs::absolute(root), max_size * 1024 * 1024);
+    ActionCacheServiceImpl service(ac);
+    service.trim();
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(listen, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    auto server = builder.BuildAndStart();
+    if (!server)
+    {
+        LOG_ERROR(logger, "Cannot listen on " << listen);
+        return 1;
+    }
+    LOG_INFO(logger, "Serving action cache from " << normalize_path(fs::absolute(root)) << " on " << listen);
+    server->Wait();
+    return 0;
+}
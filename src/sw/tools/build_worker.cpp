@@ -0,0 +1,252 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// DistributedBuildService worker
+//
+// usage: build_worker [-listen host:port] [-root dir] [-j N]
+//
+// Several workers may run on one machine for testing.
+// Worker never overwrites files it did not create,
+// commands that need a different version of such file are rejected.
+
+#include <sw/builder/process.h>
+#include <sw/builder/remote_action_cache.h>
+
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+#include <primitives/sw/settings_program_name.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <unordered_set>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "build_worker");
+
+using namespace sw;
+
+struct BuildWorker final : api::build::DistributedBuildService::Service
+{
+    BuildWorker(ActionCache &ac, int jobs) : ac(ac), free_jobs(jobs) {}
+
+    grpc::Status ExecuteCommand(grpc::ServerContext *, const api::build::Command *request,
+        api::build::CommandResult *response) override
+    {
+        return wrap([&]()
+        {
+            auto program = fs::u8path(request->program());
+            if (!fs::exists(program) || hashFile(program) != fromProto(request->program_hash()))
+                return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "different program: " + request->program());
+            if (auto s = materialize(*request); !s.ok())
+                return s;
+            for (auto &o : request->outputs())
+                fs::create_directories(fs::u8path(o).parent_path());
+
+            primitives::Command c;
+            c.setProgram(program);
+            for (auto &a : request->arguments())
+                c.push_back(a);
+            for (auto &[k, v] : request->environment())
+                c.environment[k] = v;
+            c.working_directory = fs::u8path(request->working_directory());
+
+            std::error_code ec;
+            {
+                JobSlot js(*this);
+                ProcessUsage u;
+                if (!executeAndMeasure(c, ec, u))
+                    c.execute(ec);
+            }
+            if (ec && !c.exit_code)
+                return grpc::Status(grpc::StatusCode::INTERNAL, "cannot run program: " + ec.message());
+
+            response->set_exit_code(c.exit_code.value_or(0));
+            response->set_out(c.out.text);
+            response->set_err(c.err.text);
+            if (response->exit_code())
+                return grpc::Status::OK;
+
+            std::vector<ActionCache::CachedFile> outputs;
+            for (auto &o : request->outputs())
+            {
+                auto p = fs::u8path(o);
+                if (!fs::exists(p))
+                    continue;
+                auto h = hash128(read_file(p));
+                ac.storeBlob(h, p);
+                outputs.push_back({ o, h });
+                own(o);
+            }
+            toProto(outputs, *response->mutable_outputs());
+            return grpc::Status::OK;
+        });
+    }
+
+    grpc::Status FindMissingBlobs(grpc::ServerContext *, const api::build::FindMissingBlobsRequest *request,
+        api::build::FindMissingBlobsResponse *response) override
+    {
+        return wrap([&]() { return serveFindMissingBlobs(ac, *request, *response); });
+    }
+
+    grpc::Status ReadBlob(grpc::ServerContext *, const api::build::ReadBlobRequest *request,
+        grpc::ServerWriter<api::build::BlobChunk> *writer) override
+    {
+        return wrap([&]() { return serveReadBlob(ac, *request, *writer); });
+    }
+
+    grpc::Status WriteBlob(grpc::ServerContext *, grpc::ServerReader<api::build::BlobChunk> *reader,
+        google::protobuf::Empty *) override
+    {
+        return wrap([&]() { return serveWriteBlob(ac, *reader); });
+    }
+
+private:
+    struct HashedFile
+    {
+        fs::file_time_type mtime;
+        uintmax_t size = 0;
+        Hash128 hash;
+    };
+
+    // limits number of running processes, grpc may serve more requests
+    struct JobSlot
+    {
+        BuildWorker &w;
+
+        JobSlot(BuildWorker &w) : w(w)
+        {
+            std::unique_lock lk(w.jobs_mutex);
+            w.jobs_cv.wait(lk, [&w] { return w.free_jobs > 0; });
+            w.free_jobs--;
+        }
+
+        ~JobSlot()
+        {
+            {
+                std::unique_lock lk(w.jobs_mutex);
+                w.free_jobs++;
+            }
+            w.jobs_cv.notify_one();
+        }
+    };
+
+    ActionCache &ac;
+
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_cv;
+    int free_jobs;
+
+    std::mutex files_mutex;
+    // files created by this worker, only they may be overwritten
+    std::unordered_set<String> owned;
+    std::unordered_map<String, HashedFile> hashes;
+
+    Hash128 hashFile(const path &p)
+    {
+        HashedFile f;
+        f.mtime = fs::last_write_time(p);
+        f.size = fs::file_size(p);
+        auto s = normalize_path(p);
+        {
+            std::unique_lock lk(files_mutex);
+            auto i = hashes.find(s);
+            if (i != hashes.end() && i->second.mtime == f.mtime && i->second.size == f.size)
+                return i->second.hash;
+        }
+        f.hash = hash128(read_file(p));
+        std::unique_lock lk(files_mutex);
+        hashes[s] = f;
+        return f.hash;
+    }
+
+    void own(const String &p)
+    {
+        std::unique_lock lk(files_mutex);
+        owned.insert(p);
+    }
+
+    bool isOwned(const String &p)
+    {
+        std::unique_lock lk(files_mutex);
+        return owned.count(p);
+    }
+
+    grpc::Status materialize(const api::build::Command &request)
+    {
+        // commands of one build use the same versions of files
+        static std::mutex m;
+        std::unique_lock lk(m);
+        for (auto &i : fromProto(request.inputs()))
+        {
+            auto p = fs::u8path(i.path);
+            if (fs::exists(p))
+            {
+                if (hashFile(p) == i.hash)
+                    continue;
+                if (!isOwned(i.path))
+                    return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "different local file: " + i.path);
+            }
+            fs::create_directories(p.parent_path());
+            if (!ac.restoreBlob(i.hash, p))
+                return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "missing blob for " + i.path);
+            own(i.path);
+        }
+        return grpc::Status::OK;
+    }
+
+    template <class F>
+    static grpc::Status wrap(F &&f)
+    {
+        try
+        {
+            return f();
+        }
+        catch (std::exception &e)
+        {
+            LOG_ERROR(logger, e.what());
+            return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    static cl::opt<String> listen("listen", cl::desc("Address to listen on"), cl::init("localhost:50052"));
+    static cl::opt<path> root("root", cl::desc("Blob storage directory"), cl::init("build_worker"));
+    static cl::opt<int> jobs("j", cl::desc("Number of simultaneously running commands"), cl::init((int)std::thread::hardware_concurrency()));
+    static cl::opt<uint64_t> max_size("max-size", cl::desc("Max blob storage size (MB)"), cl::init(10 * 1024));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    ActionCache ac(fs::absolute(root), max_size * 1024 * 1024);
+    ac.trim();
+    BuildWorker worker(ac, std::max(1, (int)jobs));
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(listen, grpc::InsecureServerCredentials());
+    builder.RegisterService(&worker);
+    auto server = builder.BuildAndStart();
+    if (!server)
+    {
+        LOG_ERROR(logger, "Cannot listen on " << listen);
+        return 1;
+    }
+    LOG_INFO(logger, "Build worker is listening on " << listen << ", jobs: " << jobs);
+    server->Wait();
+    return 0;
+}
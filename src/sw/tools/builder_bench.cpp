@@ -0,0 +1,432 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// synthetic benchmarks for builder internals
+//
+// usage: builder_bench schedule|executor|topo|reduction|spawn [threads]
+
+#include <sw/builder/execution_plan.h>
+#include <sw/builder/process.h>
+
+#include <primitives/executor.h>
+#include <primitives/sw/settings_program_name.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace sw;
+
+using BenchClock = std::chrono::steady_clock;
+
+struct SyntheticCommand : CommandNode
+{
+    size_t id;
+    std::chrono::microseconds duration;
+
+    SyntheticCommand(size_t id, std::chrono::microseconds duration)
+        : id(id), duration(duration)
+    {
+    }
+
+    String getName(bool short_name = false) const override { return "synthetic " + std::to_string(id); }
+    size_t getHash() const override { return id + 1; }
+    void execute() override { std::this_thread::sleep_for(duration); }
+    void prepare() override {}
+    uint64_t getExecutionCost() const override { return duration.count(); }
+
+    bool lessDuringExecution(const CommandNode &rhs) const override
+    {
+        return dependencies.size() < rhs.dependencies.size();
+    }
+};
+
+using SyntheticCommands = std::unordered_set<std::shared_ptr<SyntheticCommand>>;
+
+struct Dag
+{
+    String name;
+    std::function<SyntheticCommands()> create;
+};
+
+static void add_dep(const std::shared_ptr<SyntheticCommand> &c, const std::shared_ptr<SyntheticCommand> &d)
+{
+    c->dependencies.insert(d);
+}
+
+// many short compile-like commands and one long link chain
+// that has no priority in the default order
+static SyntheticCommands late_chain(size_t n)
+{
+    std::mt19937 g(1);
+    std::uniform_int_distribution<> short_d(500, 3'000);
+
+    SyntheticCommands cmds;
+    size_t id = 0;
+    for (size_t i = 0; i < n; i++)
+        cmds.insert(std::make_shared<SyntheticCommand>(id++, std::chrono::microseconds(short_d(g))));
+
+    std::shared_ptr<SyntheticCommand> prev;
+    for (size_t i = 0; i < 10; i++)
+    {
+        auto c = std::make_shared<SyntheticCommand>(id++, std::chrono::milliseconds(20));
+        if (prev)
+            add_dep(c, prev);
+        cmds.insert(c);
+        prev = c;
+    }
+    return cmds;
+}
+
+// layered random graph similar to libraries depending on each other
+static SyntheticCommands layered(size_t n)
+{
+    std::mt19937 g(2);
+    std::lognormal_distribution<> dur(7.0, 1.0); // ~1ms median, long tail
+
+    const size_t n_layers = 8;
+    std::vector<std::vector<std::shared_ptr<SyntheticCommand>>> layers(n_layers);
+    SyntheticCommands cmds;
+    size_t id = 0;
+    for (size_t l = 0; l < n_layers; l++)
+    {
+        for (size_t i = 0; i < n / n_layers; i++)
+        {
+            auto d = std::min<int64_t>((int64_t)dur(g), 50'000);
+            auto c = std::make_shared<SyntheticCommand>(id++, std::chrono::microseconds(d));
+            if (l)
+            {
+                std::uniform_int_distribution<size_t> prev(0, layers[l - 1].size() - 1);
+                for (int k = 0; k < 3; k++)
+                    add_dep(c, layers[l - 1][prev(g)]);
+            }
+            layers[l].push_back(c);
+            cmds.insert(c);
+        }
+    }
+    return cmds;
+}
+
+template <class E>
+static double run_plan(const SyntheticCommands &cmds, E &e, bool critical_path)
+{
+    auto p = ExecutionPlan::create(cmds);
+    p->critical_path_scheduling = critical_path;
+    auto start = BenchClock::now();
+    p->execute(e);
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static void bench_schedule(size_t threads)
+{
+    Executor e(threads);
+
+    std::vector<Dag> dags;
+    dags.push_back({ "late chain", [] { return late_chain(2'000); } });
+    dags.push_back({ "layered", [] { return layered(4'000); } });
+
+    for (auto &d : dags)
+    {
+        // plans clear command edges on destruction, so create new dag every time
+        auto def = run_plan(d.create(), e, false);
+        auto cp = run_plan(d.create(), e, true);
+        std::cout << d.name << ": default order = " << def << " s, critical path = " << cp << " s, speedup = " << def / cp << "\n";
+    }
+}
+
+// thousands of tiny builtin-like commands
+static SyntheticCommands tiny(size_t n)
+{
+    SyntheticCommands cmds;
+    std::vector<std::shared_ptr<SyntheticCommand>> prev;
+    for (size_t i = 0; i < n; i++)
+    {
+        auto c = std::make_shared<SyntheticCommand>(i, std::chrono::microseconds(0));
+        if (i >= 64)
+            add_dep(c, prev[i - 64]);
+        prev.push_back(c);
+        cmds.insert(c);
+    }
+    return cmds;
+}
+
+static void bench_executor(size_t threads)
+{
+    Executor e(threads);
+    WorkStealingExecutor ws(threads);
+
+    std::vector<Dag> dags;
+    dags.push_back({ "tiny", [] { return tiny(50'000); } });
+    dags.push_back({ "layered", [] { return layered(4'000); } });
+
+    for (auto &d : dags)
+    {
+        auto ge = run_plan(d.create(), e, true);
+        auto wse = run_plan(d.create(), ws, true);
+        std::cout << d.name << ": generic = " << ge << " s, work stealing = " << wse << " s, speedup = " << ge / wse << "\n";
+    }
+}
+
+// deep random dag: every node depends on the previous one and on a few random earlier nodes
+static SyntheticCommands deep(size_t n)
+{
+    std::mt19937 g(3);
+    std::vector<std::shared_ptr<SyntheticCommand>> v;
+    v.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto c = std::make_shared<SyntheticCommand>(i, std::chrono::microseconds(0));
+        if (i)
+        {
+            add_dep(c, v[i - 1]);
+            std::uniform_int_distribution<size_t> prev(0, i - 1);
+            for (int k = 0; k < 3; k++)
+                add_dep(c, v[prev(g)]);
+        }
+        v.push_back(c);
+    }
+    return SyntheticCommands(v.begin(), v.end());
+}
+
+static void bench_topo(size_t)
+{
+    for (size_t n : { 10'000, 100'000, 1'000'000 })
+    {
+        auto cmds = deep(n);
+        ExecutionPlan::USet s;
+        for (auto &c : cmds)
+            s.insert(c.get());
+
+        ExecutionPlan::VecT v(s.begin(), s.end());
+        auto start = BenchClock::now();
+        auto g = ExecutionPlan::getIndexGraph(v);
+        auto t_graph = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+        start = BenchClock::now();
+        auto order = getTopologicalOrder(g);
+        auto t_order = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+        start = BenchClock::now();
+        auto cycles = getCycles(g);
+        auto t_cycles = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+        start = BenchClock::now();
+        {
+            ExecutionPlan p(s);
+            if (!p.isValid() || order.size() != n || !cycles.empty())
+                throw std::logic_error("bad plan");
+        }
+        auto t_init = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+        std::cout << n << " nodes, " << g.edges.size() << " edges: index graph = " << t_graph
+            << " s, topological order = " << t_order << " s, cycles = " << t_cycles
+            << " s, plan init = " << t_init << " s\n";
+    }
+}
+
+// header heavy libraries: every compile command depends on all generated headers
+// of its library and of the libraries below, generators depend on each other
+static SyntheticCommands header_heavy(size_t n_libs)
+{
+    const size_t n_generated = 50;
+    const size_t n_compiles = 200;
+
+    SyntheticCommands cmds;
+    size_t id = 0;
+    auto add = [&cmds, &id]()
+    {
+        auto c = std::make_shared<SyntheticCommand>(id++, std::chrono::microseconds(0));
+        cmds.insert(c);
+        return c;
+    };
+
+    std::vector<std::shared_ptr<SyntheticCommand>> generated, links;
+    for (size_t l = 0; l < n_libs; l++)
+    {
+        // configure step, then generators using its output
+        auto configure = add();
+        if (!links.empty())
+            add_dep(configure, links.back());
+        for (size_t i = 0; i < n_generated; i++)
+        {
+            auto g = add();
+            add_dep(g, configure);
+            generated.push_back(g);
+        }
+
+        auto link = add();
+        for (size_t i = 0; i < n_compiles; i++)
+        {
+            auto c = add();
+            for (auto &g : generated)
+                add_dep(c, g);
+            add_dep(link, c);
+        }
+        for (auto &l : links)
+            add_dep(link, l);
+        links.push_back(link);
+    }
+    return cmds;
+}
+
+static void bench_reduction(size_t threads)
+{
+    WorkStealingExecutor e(threads);
+
+    std::vector<Dag> dags;
+    dags.push_back({ "header heavy", [] { return header_heavy(20); } });
+    dags.push_back({ "layered", [] { return layered(40'000); } });
+    dags.push_back({ "deep", [] { return deep(10'000); } });
+
+    for (auto &d : dags)
+    {
+        for (bool reduce : { false, true })
+        {
+            auto cmds = d.create();
+            // commands do nothing, so execution time is pure scheduling overhead
+            for (auto &c : cmds)
+                c->duration = {};
+
+            auto start = BenchClock::now();
+            auto p = ExecutionPlan::create(cmds);
+            auto edges = p->getNumberOfEdges();
+            if (reduce)
+                p->transitiveReduction();
+            auto t_plan = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+            start = BenchClock::now();
+            p->execute(e);
+            auto t_exec = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+            std::cout << d.name << (reduce ? ", reduced" : "") << ": " << p->getCommands().size() << " commands, "
+                << edges << " -> " << p->getNumberOfEdges() << " edges, plan = " << t_plan
+                << " s, execution = " << t_exec << " s\n";
+        }
+    }
+}
+
+// runs f(i) for i in [0, n) on 'threads' threads, returns seconds
+template <class F>
+static double parallel_for(size_t n, size_t threads, F &&f)
+{
+    auto start = BenchClock::now();
+    std::atomic_size_t next = 0;
+    std::vector<std::thread> t;
+    for (size_t i = 0; i < threads; i++)
+    {
+        t.emplace_back([&next, n, &f]()
+        {
+            for (size_t i; (i = next++) < n;)
+                f(i);
+        });
+    }
+    for (auto &i : t)
+        i.join();
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// spawn overhead of trivial commands
+static void bench_spawn(size_t threads)
+{
+#ifdef _WIN32
+    std::cerr << "spawn benchmark is not supported on this platform\n";
+#else
+    const size_t n = 10'000;
+    std::vector<primitives::Command> cmds(n);
+    for (auto &c : cmds)
+    {
+        c.setProgram("/bin/true");
+        c.environment["SW_BENCH"] = "1"; // forces environment block
+    }
+
+    auto check = [](std::error_code &ec)
+    {
+        if (ec)
+            throw std::runtime_error("command failed: " + ec.message());
+    };
+
+    auto t_generic = parallel_for(n, threads, [&cmds, &check](size_t i)
+    {
+        std::error_code ec;
+        cmds[i].execute(ec);
+        check(ec);
+    });
+
+    auto t_spawn = parallel_for(n, threads, [&cmds, &check](size_t i)
+    {
+        std::error_code ec;
+        ProcessUsage u;
+        if (!executeAndMeasure(cmds[i], ec, u))
+            throw std::runtime_error("cannot spawn");
+        check(ec);
+    });
+
+    std::vector<SpawnArgs> args;
+    auto start = BenchClock::now();
+    for (auto &c : cmds)
+        args.push_back(makeSpawnArgs(c));
+    auto t_prepare = std::chrono::duration<double>(BenchClock::now() - start).count();
+    auto t_prepared = parallel_for(n, threads, [&cmds, &args, &check](size_t i)
+    {
+        std::error_code ec;
+        ProcessUsage u;
+        executeAndMeasure(cmds[i], ec, u, &args[i]);
+        check(ec);
+    });
+
+    std::cout << n << " commands: primitives = " << n / t_generic << " cmd/s, posix_spawn = " << n / t_spawn
+        << " cmd/s, posix_spawn with prepared args = " << n / t_prepared << " cmd/s (prepare = " << t_prepare << " s)\n";
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: builder_bench schedule|executor|topo|reduction|spawn [threads]\n";
+        return 1;
+    }
+
+    String b = argv[1];
+    size_t threads = argc > 2 ? std::stoi(argv[2]) : std::thread::hardware_concurrency();
+
+    if (b == "schedule")
+        bench_schedule(threads);
+    else if (b == "executor")
+        bench_executor(threads);
+    else if (b == "topo")
+        bench_topo(threads);
+    else if (b == "reduction")
+        bench_reduction(threads);
+    else if (b == "spawn")
+        bench_spawn(threads);
+    else
+    {
+        std::cerr << "unknown benchmark: " << b << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+EXPORT_FROM_EXECUTABLE
+std::string getProgramName()
+{
+    return PACKAGE_NAME_CLEAN;
+}
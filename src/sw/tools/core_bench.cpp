@@ -0,0 +1,156 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2017-2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// synthetic benchmarks for core internals
+//
+// usage: core_bench settings [n]
+
+#include <sw/core/settings.h>
+
+#include <primitives/sw/settings_program_name.h>
+
+#include <chrono>
+#include <iostream>
+
+using namespace sw;
+
+using BenchClock = std::chrono::steady_clock;
+
+// returns seconds
+template <class F>
+static double measure(F &&f)
+{
+    auto start = BenchClock::now();
+    f();
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// settings of a typical native target
+static TargetSettings make_settings(size_t i)
+{
+    TargetSettings s;
+    s["os"]["kernel"] = "org.torvalds.linux";
+    s["os"]["arch"] = i % 2 ? "x86_64" : "aarch64";
+    s["native"]["library"] = i % 3 ? "shared" : "static";
+    s["native"]["configuration"] = i % 5 ? "release" : "debug";
+    s["native"]["mt"] = "false";
+    s["native"]["program"]["c"] = "org.gnu.gcc-10";
+    s["native"]["program"]["cpp"] = "org.gnu.gpp-10";
+    s["native"]["program"]["lib"] = "org.gnu.binutils.ar";
+    s["native"]["program"]["link"] = "org.gnu.gpp-10";
+    s["native"]["stdlib"]["c"] = "org.gnu.glibc";
+    s["native"]["stdlib"]["cpp"] = "org.gnu.gcc.libstdcxx";
+    s["native"]["stdlib"]["compiler"].push_back("org.gnu.gcc.libgcc");
+    s["driver"]["source-dir-for-package"]["org.sw.demo.pkg" + std::to_string(i % 50)] = "/src/pkg" + std::to_string(i % 50);
+    s["dummy"] = "1";
+    s["dummy"].useInHash(false);
+    return s;
+}
+
+static void bench_settings(size_t n)
+{
+    std::vector<TargetSettings> v;
+    v.reserve(n);
+    auto t_construct = measure([&v, n]()
+    {
+        for (size_t i = 0; i < n; i++)
+            v.push_back(make_settings(i));
+    });
+
+    std::vector<TargetSettings> copies;
+    copies.reserve(n);
+    auto t_copy = measure([&v, &copies]()
+    {
+        for (auto &s : v)
+            copies.push_back(s);
+    });
+
+    size_t sink = 0;
+    auto t_hash = measure([&copies, &sink]()
+    {
+        for (auto &s : copies)
+            sink += s.getHash().size();
+    });
+    auto t_hash_cached = measure([&copies, &sink]()
+    {
+        for (auto &s : copies)
+            sink += s.getHash().size();
+    });
+
+    auto t_json = measure([&v, &sink]()
+    {
+        for (auto &s : v)
+            sink += s.toString().size();
+    });
+
+    // every settings against a window of others, like findSuitable() does;
+    // the first pass computes hashes of never hashed settings
+    const size_t window = 32;
+    auto compare = [&v, &sink, n]()
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            for (size_t j = 0; j < window; j++)
+                sink += v[i] == v[(i + j) % n];
+        }
+    };
+    auto t_eq_cold = measure(compare);
+    auto t_eq = measure(compare);
+
+    TargetSettings sub;
+    sub["os"]["arch"] = "x86_64";
+    sub["native"]["library"] = "shared";
+    auto t_subset = measure([&v, &sub, &sink]()
+    {
+        for (auto &s : v)
+            sink += sub.isSubsetOf(s);
+    });
+
+    std::cout << n << " settings: construct = " << t_construct << " s, copy = " << t_copy
+        << " s, hash = " << t_hash << " s, cached hash = " << t_hash_cached
+        << " s, json = " << t_json << " s\n";
+    std::cout << n * window << " comparisons: first = " << t_eq_cold << " s, next = " << t_eq
+        << " s, " << n << " subset checks = " << t_subset << " s (" << sink << ")\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: core_bench settings [n]\n";
+        return 1;
+    }
+
+    String b = argv[1];
+    size_t n = argc > 2 ? std::stoi(argv[2]) : 100'000;
+
+    if (b == "settings")
+        bench_settings(n);
+    else
+    {
+        std::cerr << "unknown benchmark: " << b << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+EXPORT_FROM_EXECUTABLE
+std::string getProgramName()
+{
+    return PACKAGE_NAME_CLEAN;
+}
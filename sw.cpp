@@ -25,6 +25,7 @@ void build(Solution &s)
             "pub.egorpugin.primitives.log-master"_dep,
             "pub.egorpugin.primitives.executor-master"_dep,
             "pub.egorpugin.primitives.symbol-master"_dep,
+            "org.sw.demo.Cyan4973.xxHash"_dep,
             "org.sw.demo.boost.property_tree"_dep,
             "org.sw.demo.boost.stacktrace"_dep;
         //cmddep->getSettings()["export-if-static"] = "true";
@@ -117,6 +118,7 @@ void build(Solution &s)
         builder.Public += manager,
             "org.sw.demo.preshing.junction-master"_dep,
             "org.sw.demo.boost.graph"_dep,
+            "org.sw.demo.boost.interprocess"_dep,
             "org.sw.demo.boost.serialization"_dep,
             "org.sw.demo.microsoft.gsl"_dep,
             "pub.egorpugin.primitives.emitter-master"_dep;
@@ -127,6 +129,26 @@ void build(Solution &s)
             pch.force_include_pch = true;*/
             //builder.addPrecompiledHeader(pch);
         }
+
+        auto &bench = builder.addTarget<ExecutableTarget>("bench");
+        bench.PackageDefinitions = true;
+        bench += cpp17;
+        bench += "src/sw/tools/builder_bench.cpp";
+        bench += builder;
+
+        auto &action_cache_server = builder.addTarget<ExecutableTarget>("action_cache_server");
+        action_cache_server.PackageDefinitions = true;
+        action_cache_server += cpp17;
+        action_cache_server += "src/sw/tools/action_cache_server.cpp";
+        action_cache_server += builder,
+            "pub.egorpugin.primitives.sw.main-master"_dep;
+
+        auto &build_worker = builder.addTarget<ExecutableTarget>("build_worker");
+        build_worker.PackageDefinitions = true;
+        build_worker += cpp17;
+        build_worker += "src/sw/tools/build_worker.cpp";
+        build_worker += builder,
+            "pub.egorpugin.primitives.sw.main-master"_dep;
     }
 
     auto &core = p.addTarget<LibraryTarget>("core");
@@ -140,6 +162,12 @@ void build(Solution &s)
         embed2("pub.egorpugin.primitives.tools.embedder2-master"_dep, core, "src/sw/core/inserts/input_db_schema.sql");
         gen_sqlite2cpp("pub.egorpugin.primitives.tools.sqlpp11.sqlite2cpp-master"_dep,
             core, core.SourceDir / "src/sw/core/inserts/input_db_schema.sql", "db_inputs.h", "db::inputs");
+
+        auto &bench = core.addTarget<ExecutableTarget>("bench");
+        bench.PackageDefinitions = true;
+        bench += cpp17;
+        bench += "src/sw/tools/core_bench.cpp";
+        bench += core;
     }
 
     auto &cpp_driver = p.addTarget<LibraryTarget>("driver.cpp");
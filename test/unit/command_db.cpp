@@ -0,0 +1,307 @@
+#include <sw/builder/command_storage.h>
+#include <sw/builder/path_interner.h>
+#include <sw/builder/sw_context.h>
+
+#include <primitives/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static path get_test_dir(const String &name)
+{
+    auto d = fs::temp_directory_path() / "sw_test_command_db" / name;
+    fs::remove_all(d);
+    fs::create_directories(d);
+    return d;
+}
+
+static CommandRecord make_record(size_t hash, int n_history, const std::vector<FileId> &inputs = {})
+{
+    CommandRecord r;
+    r.hash = hash;
+    r.mtime = fs::file_time_type(fs::file_time_type::duration(hash * 3));
+    r.inputs_hash = Hash128{ hash, hash + 1 };
+    r.outputs_hash = Hash128{ hash + 2, hash + 3 };
+    for (int i = 0; i < n_history; i++)
+    {
+        CommandExecutionStats s;
+        s.wall = (uint32_t)(hash + i);
+        r.addExecution(s);
+    }
+    r.setImplicitInputs(inputs);
+    r.dirty = true;
+    return r;
+}
+
+static void check_record(const detail::CommandDb &db, const CommandRecord &expected)
+{
+    CommandRecord r;
+    REQUIRE(db.find(expected.hash, r));
+    CHECK(r.mtime == expected.mtime);
+    CHECK(r.inputs_hash == expected.inputs_hash);
+    CHECK(r.outputs_hash == expected.outputs_hash);
+    REQUIRE(r.history.size() == expected.history.size());
+    for (size_t i = 0; i < r.history.size(); i++)
+        CHECK(r.history[i].wall == expected.history[i].wall);
+    CHECK(r.implicit_inputs == expected.implicit_inputs);
+}
+
+static std::vector<const CommandRecord *> get_ptrs(const std::vector<CommandRecord> &v)
+{
+    std::vector<const CommandRecord *> p;
+    for (auto &r : v)
+        p.push_back(&r);
+    return p;
+}
+
+TEST_CASE("Checking command db", "[command_db]")
+{
+    auto dir = get_test_dir("db");
+    auto fn = dir / "commands.bin";
+
+    std::vector<FileId> inputs;
+    for (int i = 0; i < 3; i++)
+        inputs.push_back(getPathInterner().intern(dir / ("input" + std::to_string(i) + ".h")));
+
+    SECTION("empty")
+    {
+        detail::CommandDb db(fn);
+        CHECK_FALSE(db.exists());
+        CHECK(db.size() == 0);
+        CommandRecord r;
+        CHECK_FALSE(db.find(1, r));
+    }
+
+    SECTION("slot probing")
+    {
+        // sequential hashes and hashes with the same low bits share probe chains
+        std::vector<CommandRecord> records;
+        for (size_t i = 1; i <= 700; i++)
+            records.push_back(make_record(i, i % 4, i % 2 ? inputs : std::vector<FileId>{}));
+        for (size_t i = 1; i <= 700; i++)
+            records.push_back(make_record(i << 40, 1));
+
+        detail::CommandDb db(fn);
+        REQUIRE(db.update(get_ptrs(records)));
+        REQUIRE(db.exists());
+        CHECK(db.size() == records.size());
+        for (auto &r : records)
+            check_record(db, r);
+
+        CommandRecord r;
+        CHECK_FALSE(db.find(701, r));
+        CHECK_FALSE(db.find(0, r));
+    }
+
+    SECTION("in place")
+    {
+        std::vector<CommandRecord> records;
+        for (size_t i = 1; i <= 100; i++)
+            records.push_back(make_record(i, 1));
+        {
+            detail::CommandDb db(fn);
+            REQUIRE(db.update(get_ptrs(records)));
+        }
+
+        // other process keeps its mapping and sees updates
+        detail::CommandDb reader(fn);
+        auto sz = fs::file_size(fn);
+        std::vector<CommandRecord> updates{
+            make_record(1, CommandRecord::max_history), // fits
+            make_record(2, 1, inputs), // moved
+            make_record(1000, 2, { getPathInterner().intern(dir / "new.h") }), // new
+        };
+        {
+            detail::CommandDb db(fn);
+            REQUIRE(db.update(get_ptrs(updates)));
+        }
+        CHECK(fs::file_size(fn) == sz);
+        CHECK(reader.size() == 101);
+        for (auto &r : updates)
+            check_record(reader, r);
+        for (size_t i = 2; i < 100; i++)
+            check_record(reader, records[i]);
+    }
+
+    SECTION("rebuild")
+    {
+        std::vector<CommandRecord> records;
+        for (size_t i = 1; i <= 100; i++)
+            records.push_back(make_record(i, 1));
+        {
+            detail::CommandDb db(fn);
+            REQUIRE(db.update(get_ptrs(records)));
+        }
+
+        // grow existing records, add new ones beyond the initial capacity,
+        // garbage is left by moved records
+        std::vector<CommandRecord> updates;
+        for (size_t i = 1; i <= 50; i++)
+            updates.push_back(make_record(i, CommandRecord::max_history, inputs));
+        for (size_t i = 1000; i < 3000; i++)
+            updates.push_back(make_record(i, 2));
+        for (int round = 0; round < 10; round++)
+        {
+            auto input = getPathInterner().intern(dir / ("round" + std::to_string(round) + ".h"));
+            for (auto &r : updates)
+                r.setImplicitInputs({ input });
+            detail::CommandDb db(fn);
+            REQUIRE(db.update(get_ptrs(updates)));
+        }
+
+        detail::CommandDb db(fn);
+        CHECK(db.size() == 100 + 2000);
+        for (auto &r : updates)
+            check_record(db, r);
+        for (size_t i = 50; i < 100; i++)
+            check_record(db, records[i]);
+    }
+
+    SECTION("stale mapping")
+    {
+        // two processes map the same db, both must keep their records
+        std::vector<CommandRecord> a{ make_record(1, 1), make_record(2, 1) };
+        std::vector<CommandRecord> b{ make_record(3, 2), make_record(4, 2) };
+        {
+            detail::CommandDb db(fn);
+            REQUIRE(db.update({ &a[0] }));
+        }
+
+        detail::CommandDb db1(fn);
+        detail::CommandDb db2(fn);
+        REQUIRE(db2.update(get_ptrs(b)));
+        check_record(db1, a[0]);
+        check_record(db1, b[0]);
+        REQUIRE(db1.update({ &a[1] }));
+
+        detail::CommandDb db(fn);
+        CHECK(db.size() == 4);
+        for (auto &r : a)
+            check_record(db, r);
+        for (auto &r : b)
+            check_record(db, r);
+    }
+
+    SECTION("record being written")
+    {
+        std::vector<CommandRecord> records{ make_record(0x5a5a5a5a, 3, inputs), make_record(0x6b6b6b6b, 3) };
+        {
+            detail::CommandDb db(fn);
+            REQUIRE(db.update(get_ptrs(records)));
+        }
+
+        // change data of the first record without its slot
+        auto v = read_file(fn);
+        auto p = v.find(std::string((const char *)records[0].history.data(), sizeof(CommandExecutionStats)));
+        REQUIRE(p != v.npos);
+        v[p]++;
+        write_file(fn, v);
+
+        detail::CommandDb db(fn);
+        CommandRecord r;
+        CHECK_FALSE(db.find(records[0].hash, r));
+        check_record(db, records[1]);
+    }
+
+    SECTION("corrupted")
+    {
+        write_file(fn, "garbage");
+        detail::CommandDb db(fn);
+        CHECK_FALSE(db.exists());
+
+        std::vector<CommandRecord> records{ make_record(1, 1) };
+        REQUIRE(db.update(get_ptrs(records)));
+        check_record(db, records[0]);
+    }
+}
+
+TEST_CASE("Checking command log replay", "[command_db]")
+{
+    auto root = get_test_dir("log");
+    SwBuilderContext swctx;
+    FileDb fdb(swctx);
+
+    auto input = getPathInterner().intern(root / "input.h");
+    auto r1 = make_record(11, 1, { input });
+    auto r2 = make_record(12, 3);
+
+    auto write_log = [&]()
+    {
+        detail::Storage s;
+        fdb.load(s, root);
+        for (auto r : { &r1, &r2 })
+        {
+            std::vector<uint8_t> v;
+            FileDb::write(v, *r, s);
+            s.getLog(swctx, root)->push(std::move(v), r->implicit_inputs);
+        }
+        s.closeLogs();
+    };
+
+    // unfinished build, records are only in the log
+    write_log();
+
+    // replay, small log is not merged
+    {
+        detail::Storage s;
+        CHECK(fdb.load(s, root));
+        CHECK_FALSE(s.db->exists());
+        for (auto r : { &r1, &r2 })
+        {
+            auto l = s.storage.find(r->hash);
+            REQUIRE(l);
+            CHECK(l->dirty);
+            CHECK(l->mtime == r->mtime);
+            CHECK(l->history.size() == r->history.size());
+            CHECK(l->implicit_inputs == r->implicit_inputs);
+        }
+        fdb.save(s, root);
+    }
+
+    // records are moved into db, log is removed
+    {
+        detail::Storage s;
+        CHECK(fdb.load(s, root));
+        fdb.log_merge_size = 0;
+        fdb.save(s, root);
+    }
+    {
+        detail::Storage s;
+        CHECK_FALSE(fdb.load(s, root));
+        REQUIRE(s.db->exists());
+        CHECK(s.db->size() == 2);
+        check_record(*s.db, r1);
+        check_record(*s.db, r2);
+    }
+
+    // paths of the log are lost, record must not look up to date
+    write_log();
+    {
+        std::vector<path> files;
+        for (auto &p : fs::recursive_directory_iterator(root / "db"))
+        {
+            if (p.path().extension() == ".files")
+                files.push_back(p.path());
+        }
+        REQUIRE(files.size() == 1);
+        fs::remove(files[0]);
+        detail::Storage s;
+        CHECK(fdb.load(s, root));
+        auto l = s.storage.find(r1.hash);
+        REQUIRE(l);
+        CHECK(l->mtime == fs::file_time_type::min());
+        CHECK(l->implicit_inputs.empty());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
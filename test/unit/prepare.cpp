@@ -0,0 +1,259 @@
+#include <sw/core/prepare.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+#include <condition_variable>
+#include <functional>
+
+using namespace sw;
+
+struct Event
+{
+    size_t target;
+    int pass;
+    bool begin;
+};
+
+struct PassTarget;
+
+struct PassDependency : IDependency
+{
+    PassTarget *t;
+
+    PassDependency(PassTarget &t) : t(&t) {}
+
+    const TargetSettings &getSettings() const override { throw std::logic_error("not used"); }
+    UnresolvedPackage getUnresolvedPackage() const override { throw std::logic_error("not used"); }
+    bool isResolved() const override { return true; }
+    void setTarget(const ITarget &) override { throw std::logic_error("not used"); }
+    const ITarget &getTarget() const override;
+};
+
+// target that records its passes
+struct PassTarget : ITarget
+{
+    size_t id;
+    int n_passes;
+    int pass = 0;
+    std::vector<std::unique_ptr<PassDependency>> deps;
+    std::vector<Event> *events;
+    std::mutex *m;
+    std::function<void(int)> on_pass;
+
+    PassTarget(size_t id, int n_passes, std::vector<Event> &events, std::mutex &m)
+        : id(id), n_passes(n_passes), events(&events), m(&m)
+    {
+    }
+
+    void addDependency(PassTarget &t) { deps.push_back(std::make_unique<PassDependency>(t)); }
+
+    std::vector<IDependency *> getDependencies() const override
+    {
+        std::vector<IDependency *> r;
+        for (auto &d : deps)
+            r.push_back(d.get());
+        return r;
+    }
+
+    bool prepare() override
+    {
+        pass++;
+        {
+            std::unique_lock lk(*m);
+            events->push_back({ id, pass, true });
+        }
+        if (on_pass)
+            on_pass(pass);
+        {
+            std::unique_lock lk(*m);
+            events->push_back({ id, pass, false });
+        }
+        return pass < n_passes;
+    }
+
+    const LocalPackage &getPackage() const override { throw std::logic_error("not used"); }
+    const Source &getSource() const override { throw std::logic_error("not used"); }
+    Files getSourceFiles() const override { return {}; }
+    Commands getCommands() const override { return {}; }
+    Commands getTests() const override { return {}; }
+    const TargetSettings &getSettings() const override { throw std::logic_error("not used"); }
+    const TargetSettings &getInterfaceSettings() const override { throw std::logic_error("not used"); }
+};
+
+const ITarget &PassDependency::getTarget() const
+{
+    return *t;
+}
+
+struct Graph
+{
+    std::vector<std::unique_ptr<PassTarget>> targets;
+    std::vector<Event> events;
+    std::mutex m;
+
+    PassTarget &add(int n_passes)
+    {
+        targets.push_back(std::make_unique<PassTarget>(targets.size(), n_passes, events, m));
+        return *targets.back();
+    }
+
+    void run(size_t n_threads)
+    {
+        std::vector<ITarget *> v;
+        for (auto &t : targets)
+            v.push_back(t.get());
+        PrepareScheduler s(v);
+        Executor e(n_threads);
+        bool stopped = false;
+        s.run(e, stopped);
+    }
+
+    // targets reachable through deps, 'r[i][j]' is true when i depends on j
+    std::vector<std::vector<bool>> getTransitiveDependencies() const
+    {
+        std::vector<std::vector<bool>> r(targets.size(), std::vector<bool>(targets.size()));
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            std::vector<size_t> stack{ i };
+            while (!stack.empty())
+            {
+                auto t = stack.back();
+                stack.pop_back();
+                for (auto &d : targets[t]->deps)
+                {
+                    if (r[i][d->t->id])
+                        continue;
+                    r[i][d->t->id] = true;
+                    stack.push_back(d->t->id);
+                }
+            }
+        }
+        return r;
+    }
+
+    // pass N starts when all transitive deps and dependents finished pass N - 1 or all of their passes
+    void checkOrder() const
+    {
+        auto deps = getTransitiveDependencies();
+        std::vector<int> done(targets.size());
+        for (auto &e : events)
+        {
+            if (!e.begin)
+            {
+                CHECK(done[e.target] == e.pass - 1);
+                done[e.target] = e.pass;
+                continue;
+            }
+            for (size_t j = 0; j < targets.size(); j++)
+            {
+                if (j == e.target || !(deps[e.target][j] || deps[j][e.target]))
+                    continue;
+                if (done[j] == targets[j]->n_passes)
+                    continue;
+                CHECK(done[j] >= e.pass - 1);
+            }
+        }
+        for (auto &t : targets)
+            CHECK(done[t->id] == t->n_passes);
+    }
+};
+
+TEST_CASE("Checking prepare pass order", "[prepare]")
+{
+    Graph g;
+
+    SECTION("dag")
+    {
+        //   a -> b -> c
+        //   |         ^
+        //   +--> d ---+
+        //   e    f -> c
+        auto &a = g.add(4);
+        auto &b = g.add(3);
+        auto &c = g.add(5);
+        auto &d = g.add(4);
+        g.add(6);
+        auto &f = g.add(2);
+        a.addDependency(b);
+        a.addDependency(d);
+        b.addDependency(c);
+        d.addDependency(c);
+        f.addDependency(c);
+
+        for (int i = 0; i < 20; i++)
+        {
+            g.events.clear();
+            for (auto &t : g.targets)
+                t->pass = 0;
+            g.run(4);
+            g.checkOrder();
+        }
+    }
+
+    SECTION("single thread")
+    {
+        auto &a = g.add(3);
+        auto &b = g.add(5);
+        auto &c = g.add(2);
+        a.addDependency(b);
+        b.addDependency(c);
+        g.run(1);
+        g.checkOrder();
+    }
+
+    SECTION("cycle")
+    {
+        // a -> b -> c -> a, d -> a
+        auto &a = g.add(3);
+        auto &b = g.add(4);
+        auto &c = g.add(2);
+        auto &d = g.add(5);
+        a.addDependency(b);
+        b.addDependency(c);
+        c.addDependency(a);
+        d.addDependency(a);
+        g.run(4);
+        g.checkOrder();
+    }
+
+    SECTION("unrelated targets do not wait")
+    {
+        // b waits in its first pass until e is prepared completely,
+        // a waits for b, e is not connected to them
+        auto &a = g.add(3);
+        auto &b = g.add(3);
+        auto &e = g.add(5);
+        a.addDependency(b);
+
+        std::mutex m;
+        std::condition_variable cv;
+        bool e_finished = false;
+        e.on_pass = [&](int pass)
+        {
+            if (pass != e.n_passes)
+                return;
+            std::unique_lock lk(m);
+            e_finished = true;
+            cv.notify_all();
+        };
+        bool waited = false;
+        b.on_pass = [&](int pass)
+        {
+            if (pass != 1)
+                return;
+            std::unique_lock lk(m);
+            waited = cv.wait_for(lk, std::chrono::seconds(10), [&] { return e_finished; });
+        };
+        g.run(2);
+        CHECK(waited);
+        g.checkOrder();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <sw/core/settings.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+// same comparison as TargetSettings::operator== had before hashes were cached
+static bool equal_by_walk(const TargetSettings &lhs, const TargetSettings &rhs)
+{
+    // missing values are empty
+    for (auto &[k, v] : rhs)
+    {
+        if (v.ignoreInComparison())
+            continue;
+        if (lhs[k] != v)
+            return false;
+    }
+    for (auto &[k, v] : lhs)
+    {
+        if (v.ignoreInComparison())
+            continue;
+        if (v && !rhs[k])
+            return false;
+    }
+    return true;
+}
+
+static TargetSettings make_settings()
+{
+    TargetSettings s;
+    s["os"]["kernel"] = "linux";
+    s["os"]["arch"] = "x86_64";
+    s["native"]["library"] = "shared";
+    s["native"]["configuration"] = "release";
+    s["native"]["program"]["c"]["package"] = "org.gnu.gcc";
+    s["native"]["program"]["cpp"]["package"] = "org.gnu.gpp";
+    return s;
+}
+
+TEST_CASE("Checking settings hashes", "[settings]")
+{
+    auto s = make_settings();
+
+    SECTION("nested mutation")
+    {
+        auto h = s.getHash();
+        s["native"]["program"]["cpp"]["package"] = "org.LLVM.clangpp";
+        CHECK(s.getHash() != h);
+        s["native"]["program"]["cpp"]["package"] = "org.gnu.gpp";
+        CHECK(s.getHash() == h);
+    }
+
+    SECTION("references kept across getHash()")
+    {
+        auto &v = s["native"]["program"]["c"]["package"];
+        auto &m = s["native"]["program"].getMap();
+        auto h = s.getHash();
+        v = "org.LLVM.clang";
+        auto h2 = s.getHash();
+        CHECK(h2 != h);
+        m["asm"]["package"] = "org.gnu.as";
+        CHECK(s.getHash() != h2);
+        m.erase("asm");
+        v = "org.gnu.gcc";
+        CHECK(s.getHash() == h);
+    }
+
+    SECTION("copies")
+    {
+        auto h = s.getHash();
+        auto s2 = s;
+        CHECK(s2.getHash() == h);
+        s2["os"]["arch"] = "aarch64";
+        CHECK(s2.getHash() != h);
+        CHECK(s.getHash() == h);
+        CHECK(s["os"]["arch"] == "x86_64");
+    }
+}
+
+TEST_CASE("Checking settings comparison", "[settings]")
+{
+    SECTION("equal maps")
+    {
+        // other insertion order
+        TargetSettings s1 = make_settings();
+        TargetSettings s2;
+        s2["native"]["program"]["cpp"]["package"] = "org.gnu.gpp";
+        s2["native"]["program"]["c"]["package"] = "org.gnu.gcc";
+        s2["native"]["configuration"] = "release";
+        s2["native"]["library"] = "shared";
+        s2["os"]["arch"] = "x86_64";
+        s2["os"]["kernel"] = "linux";
+
+        // hash path
+        CHECK(s1 == s2);
+        CHECK(s2 == s1);
+        CHECK(s1.isSubsetOf(s2));
+        CHECK(equal_by_walk(s1, s2));
+
+        // ignored value on both sides forces the full walk
+        s1["build_dir"] = "a";
+        s1["build_dir"].ignoreInComparison(true);
+        s2["build_dir"] = "b";
+        s2["build_dir"].ignoreInComparison(true);
+        CHECK(s1 == s2);
+        CHECK(s2 == s1);
+        CHECK(equal_by_walk(s1, s2));
+
+        s2["os"]["arch"] = "aarch64";
+        CHECK_FALSE(s1 == s2);
+        CHECK_FALSE(s2 == s1);
+        CHECK_FALSE(equal_by_walk(s1, s2));
+    }
+
+    SECTION("empty values")
+    {
+        auto s1 = make_settings();
+        auto s2 = make_settings();
+        s2["native"]["stdlib"];
+        CHECK(s1 == s2);
+        CHECK(s2 == s1);
+        CHECK(equal_by_walk(s1, s2));
+    }
+
+    SECTION("ignored values")
+    {
+        auto s1 = make_settings();
+        auto s2 = make_settings();
+        s1["native"]["configuration"].ignoreInComparison(true);
+        s2["native"]["configuration"] = "debug";
+        CHECK(s1 == s2);
+        CHECK(s2 == s1);
+        CHECK(equal_by_walk(s1, s2));
+        CHECK(equal_by_walk(s2, s1));
+        CHECK(s2.isSubsetOf(s1));
+
+        // missing on other side
+        auto s3 = make_settings();
+        s3["build_dir"] = "x";
+        s3["build_dir"].ignoreInComparison(true);
+        CHECK(s3 == make_settings());
+        CHECK(make_settings() == s3);
+        CHECK(s3.isSubsetOf(make_settings()));
+
+        // not ignored difference is still found
+        s3["os"]["kernel"] = "windows";
+        CHECK_FALSE(s3 == make_settings());
+        CHECK_FALSE(make_settings() == s3);
+    }
+
+    SECTION("consumed values")
+    {
+        auto s1 = make_settings();
+        s1["native"]["library"].setUseCount(0);
+        // compute hashes before copy, copy must not reuse them
+        s1.getHash();
+        auto s2 = s1;
+        CHECK(s2["native"]["library"].isEmpty());
+        CHECK_FALSE(s1 == s2);
+        CHECK_FALSE(s2 == s1);
+        CHECK_FALSE(equal_by_walk(s1, s2));
+
+        auto s3 = make_settings();
+        s3["native"].getMap().erase("library");
+        CHECK(s2 == s3);
+        CHECK(s3 == s2);
+        CHECK(s2.getHash() == s3.getHash());
+
+        // use() drops the value when the count goes to zero
+        auto s4 = make_settings();
+        s4["native"]["library"].setUseCount(2);
+        auto h = s4.getHash();
+        s4["native"]["library"].use();
+        CHECK(s4 == make_settings());
+        s4["native"]["library"].use();
+        CHECK(s4.getHash() != h);
+        CHECK(s4 == s3);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <sw/core/target.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+
+using namespace sw;
+
+// target that knows only its settings
+struct SettingsTarget : ITarget
+{
+    TargetSettings ts;
+    int id;
+
+    SettingsTarget(const TargetSettings &ts, int id) : ts(ts), id(id) {}
+
+    const LocalPackage &getPackage() const override { throw std::logic_error("not used"); }
+    const Source &getSource() const override { throw std::logic_error("not used"); }
+    Files getSourceFiles() const override { return {}; }
+    std::vector<IDependency *> getDependencies() const override { return {}; }
+    bool prepare() override { return false; }
+    Commands getCommands() const override { return {}; }
+    Commands getTests() const override { return {}; }
+    const TargetSettings &getSettings() const override { return ts; }
+    const TargetSettings &getInterfaceSettings() const override { return ts; }
+};
+
+static TargetSettings make_settings(const char *kernel, const char *arch, const char *library, const char *configuration)
+{
+    TargetSettings s;
+    if (kernel)
+        s["os"]["kernel"] = kernel;
+    if (arch)
+        s["os"]["arch"] = arch;
+    if (library)
+        s["native"]["library"] = library;
+    if (configuration)
+        s["native"]["configuration"] = configuration;
+    s["native"]["program"]["cpp"]["package"] = "org.gnu.gpp";
+    return s;
+}
+
+static std::vector<TargetSettings> make_all_settings()
+{
+    const char *kernels[] = { "linux", "windows", nullptr };
+    const char *archs[] = { "x86_64", "aarch64", nullptr };
+    const char *libraries[] = { "shared", "static", nullptr };
+    const char *configurations[] = { "debug", "release", nullptr };
+
+    std::vector<TargetSettings> v;
+    for (auto k : kernels)
+    for (auto a : archs)
+    for (auto l : libraries)
+    for (auto c : configurations)
+        v.push_back(make_settings(k, a, l, c));
+    return v;
+}
+
+// queries are settings of targets and their variations
+static std::vector<TargetSettings> make_queries(const std::vector<TargetSettings> &all)
+{
+    auto v = all;
+    for (auto &s : all)
+    {
+        // more settings than target has
+        auto s2 = s;
+        s2["native"]["stdlib"]["cpp"] = "org.gnu.libstdcpp";
+        v.push_back(s2);
+
+        // other value of unrelated setting
+        s2 = s;
+        s2["native"]["program"]["cpp"]["package"] = "org.LLVM.clangpp";
+        v.push_back(s2);
+
+        // ignored discrimination values
+        s2 = s;
+        s2["os"]["arch"].ignoreInComparison(true);
+        v.push_back(s2);
+        s2 = s;
+        s2["native"].ignoreInComparison(true);
+        v.push_back(s2);
+
+        // ignored value outside of index
+        s2 = s;
+        s2["build_dir"] = "/tmp";
+        s2["build_dir"].ignoreInComparison(true);
+        v.push_back(s2);
+    }
+    return v;
+}
+
+static TargetContainer::Base::const_iterator find_equal_linear(const TargetContainer &tc, const TargetSettings &s)
+{
+    return std::find_if(tc.begin(), tc.end(), [&s](auto &t) { return t->getSettings() == s; });
+}
+
+static TargetContainer::Base::const_iterator find_suitable_linear(const TargetContainer &tc, const TargetSettings &s)
+{
+    return std::find_if(tc.begin(), tc.end(), [&s](auto &t) { return t->getSettings().isSubsetOf(s); });
+}
+
+static void check_lookups(const TargetContainer &tc, const std::vector<TargetSettings> &queries)
+{
+    for (auto &q : queries)
+    {
+        CHECK(tc.findEqual(q) == find_equal_linear(tc, q));
+        CHECK(tc.findSuitable(q) == find_suitable_linear(tc, q));
+    }
+}
+
+static size_t size(const TargetContainer &tc)
+{
+    return std::distance(tc.begin(), tc.end());
+}
+
+TEST_CASE("Checking target container index", "[target_container]")
+{
+    auto all = make_all_settings();
+    auto queries = make_queries(all);
+    REQUIRE(all.size() >= 8);
+
+    TargetContainer tc;
+    int id = 0;
+
+    SECTION("all targets")
+    {
+        for (auto &s : all)
+            tc.push_back(std::make_shared<SettingsTarget>(s, id++));
+        REQUIRE(size(tc) == all.size());
+        check_lookups(tc, queries);
+
+        // every target is found by its settings
+        for (auto &t : tc)
+            CHECK(*tc.findEqual(t->getSettings()) == t);
+    }
+
+    SECTION("growing container")
+    {
+        // small containers are scanned, large ones use index
+        for (auto &s : all)
+        {
+            tc.push_back(std::make_shared<SettingsTarget>(s, id++));
+            check_lookups(tc, queries);
+        }
+    }
+
+    SECTION("targets with ignored values")
+    {
+        for (size_t i = 0; i < all.size(); i++)
+        {
+            auto s = all[i];
+            if (i % 3 == 0)
+                s["os"]["kernel"].ignoreInComparison(true);
+            if (i % 5 == 0)
+                s["native"]["configuration"].ignoreInComparison(true);
+            if (i % 7 == 0)
+            {
+                s["build_dir"] = "/tmp/" + std::to_string(i);
+                s["build_dir"].ignoreInComparison(true);
+            }
+            tc.push_back(std::make_shared<SettingsTarget>(s, id++));
+        }
+        REQUIRE(size(tc) >= 8);
+        check_lookups(tc, queries);
+    }
+
+    SECTION("replacement")
+    {
+        for (auto &s : all)
+            tc.push_back(std::make_shared<SettingsTarget>(s, id++));
+        auto n = size(tc);
+
+        // equal settings, but other ignored value
+        for (size_t i = 0; i < all.size(); i += 4)
+        {
+            auto s = all[i];
+            s["build_dir"] = "/tmp/new";
+            s["build_dir"].ignoreInComparison(true);
+            auto t = std::make_shared<SettingsTarget>(s, id++);
+            tc.push_back(t);
+            CHECK(size(tc) == n);
+            CHECK(*tc.findEqual(all[i]) == t);
+            CHECK(*tc.findEqual(s) == t);
+        }
+        check_lookups(tc, queries);
+
+        // replaced target is found at the same position
+        auto s = all[1];
+        auto pos = tc.findEqual(s) - tc.begin();
+        tc.push_back(std::make_shared<SettingsTarget>(s, id++));
+        CHECK(tc.findEqual(s) - tc.begin() == pos);
+        check_lookups(tc, queries);
+    }
+
+    SECTION("erase")
+    {
+        for (auto &s : all)
+            tc.push_back(std::make_shared<SettingsTarget>(s, id++));
+
+        tc.erase(tc.begin() + 3, tc.begin() + 10);
+        CHECK(size(tc) == all.size() - 7);
+        check_lookups(tc, queries);
+
+        tc.erase(tc.begin(), tc.begin() + 1);
+        check_lookups(tc, queries);
+
+        // erased settings can be added again
+        tc.push_back(std::make_shared<SettingsTarget>(all[5], id++));
+        CHECK(tc.findEqual(all[5]) != tc.end());
+        check_lookups(tc, queries);
+
+        // below index size
+        tc.erase(tc.begin() + 4, tc.end());
+        CHECK(size(tc) == 4);
+        check_lookups(tc, queries);
+
+        tc.erase(tc.begin(), tc.end());
+        CHECK(tc.empty());
+        check_lookups(tc, queries);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}